@@ -42,8 +42,6 @@ struct core_data {
 	off64_t mem_start;
 	int mem_fd;
 
-	int blk_id;
-
 	struct core_data *next;
 };
 
@@ -51,5 +49,7 @@ extern int invalid_ident(const char *ident);
 
 extern int add_dump_list(int core_fd, size_t *core_size,
 			 struct core_data *dump_list, off64_t *dump_offset);
+extern int append_dump_list(int core_fd, void *hdr, size_t *core_size,
+			    struct core_data *dump_list, off64_t *dump_offset);
 
 #endif /* __COMMON_H__ */
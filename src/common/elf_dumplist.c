@@ -572,3 +572,178 @@ out:
 		free(note);
 	return err;
 }
+
+/* section header string table of a core without sections */
+static const char core_shstrtab[] = "\0.shstrtab\0.debug\0" NT_NAME;
+#define SHSTRTAB_NAME 1
+#define DEBUG_NAME (SHSTRTAB_NAME + sizeof(".shstrtab"))
+#define DUMPLIST_NAME (DEBUG_NAME + sizeof(".debug"))
+
+static size_t put_shdr(int elfclass, void *buf, GElf_Shdr *shdr)
+{
+	Elf32_Shdr shdr32;
+
+	if (elfclass == ELFCLASS64) {
+		memcpy(buf, shdr, sizeof(Elf64_Shdr));
+		return sizeof(Elf64_Shdr);
+	}
+
+	shdr32.sh_name = shdr->sh_name;
+	shdr32.sh_type = shdr->sh_type;
+	shdr32.sh_flags = shdr->sh_flags;
+	shdr32.sh_addr = shdr->sh_addr;
+	shdr32.sh_offset = shdr->sh_offset;
+	shdr32.sh_size = shdr->sh_size;
+	shdr32.sh_link = shdr->sh_link;
+	shdr32.sh_info = shdr->sh_info;
+	shdr32.sh_addralign = shdr->sh_addralign;
+	shdr32.sh_entsize = shdr->sh_entsize;
+	memcpy(buf, &shdr32, sizeof(shdr32));
+
+	return sizeof(shdr32);
+}
+
+/*
+ * Append the dump list to a core without sections, such as a core
+ * from the kernel. The ELF header is given in memory (at least the
+ * headers up to the first segment) and is updated there. Only the dump
+ * list note, the string table and the section headers are written to
+ * core_fd, starting at core_size. The layout is the same as with
+ * add_dump_list().
+ */
+int append_dump_list(int core_fd, void *hdr, size_t *core_size,
+		     struct core_data *dump_list, off64_t *dump_offset)
+{
+	unsigned char *ident = hdr;
+	GElf_Shdr shdr[4];
+	size_t shentsize;
+	off64_t note_off;
+	off64_t strtab_off;
+	off64_t shoff;
+	GElf_Off data_off;
+	void *note = NULL;
+	size_t note_size;
+	char *shdrs = NULL;
+	size_t shdrs_size;
+	GElf_Half phnum;
+	GElf_Off phoff;
+	GElf_Half ehsize;
+	GElf_Half phentsize;
+	int elfclass;
+	size_t pad;
+	int err = -1;
+	int i;
+
+	elfclass = ident[EI_CLASS];
+	if (elfclass == ELFCLASS64) {
+		Elf64_Ehdr *ehdr = hdr;
+
+		phoff = ehdr->e_phoff;
+		phnum = ehdr->e_phnum;
+		ehsize = ehdr->e_ehsize;
+		phentsize = ehdr->e_phentsize;
+		shentsize = sizeof(Elf64_Shdr);
+	} else if (elfclass == ELFCLASS32) {
+		Elf32_Ehdr *ehdr = hdr;
+
+		phoff = ehdr->e_phoff;
+		phnum = ehdr->e_phnum;
+		ehsize = ehdr->e_ehsize;
+		phentsize = ehdr->e_phentsize;
+		shentsize = sizeof(Elf32_Shdr);
+	} else {
+		return -1;
+	}
+
+	if (alloc_dump_note(dump_list, elfclass, &note, &note_size) != 0)
+		return -1;
+
+	note_off = *core_size;
+	strtab_off = note_off + note_size;
+	shoff = (strtab_off + sizeof(core_shstrtab) + 7) & ~7;
+	pad = shoff - (strtab_off + sizeof(core_shstrtab));
+
+	memset(shdr, 0, sizeof(shdr));
+
+	if (phnum == PN_XNUM) {
+		/* the real number follows from the first (note) segment */
+		GElf_Off first_off;
+
+		if (elfclass == ELFCLASS64)
+			first_off = ((Elf64_Phdr *)(hdr + phoff))->p_offset;
+		else
+			first_off = ((Elf32_Phdr *)(hdr + phoff))->p_offset;
+		shdr[0].sh_info = (first_off - phoff) / phentsize;
+	}
+
+	shdr[1].sh_name = SHSTRTAB_NAME;
+	shdr[1].sh_type = SHT_STRTAB;
+	shdr[1].sh_offset = strtab_off;
+	shdr[1].sh_size = sizeof(core_shstrtab);
+	shdr[1].sh_addralign = 1;
+
+	/* cover everything after the elf header (and the program headers
+	 * if they follow directly) so that there are no gaps for libelf */
+	data_off = ehsize;
+	if (data_off == phoff) {
+		data_off += (GElf_Off)phentsize *
+			    (phnum == PN_XNUM ? shdr[0].sh_info : phnum);
+	}
+	shdr[2].sh_name = DEBUG_NAME;
+	shdr[2].sh_type = SHT_PROGBITS;
+	shdr[2].sh_offset = data_off;
+	shdr[2].sh_size = note_off - data_off;
+	shdr[2].sh_addralign = 1;
+
+	shdr[3].sh_name = DUMPLIST_NAME;
+	shdr[3].sh_type = SHT_NOTE;
+	shdr[3].sh_offset = note_off;
+	shdr[3].sh_size = note_size;
+	shdr[3].sh_addralign = 4;
+
+	shdrs_size = pad + (shentsize * 4);
+	shdrs = calloc(1, shdrs_size);
+	if (!shdrs)
+		goto out;
+	for (i = 0; i < 4; i++)
+		put_shdr(elfclass, shdrs + pad + (shentsize * i), &shdr[i]);
+
+	if (note_size &&
+	    pwrite(core_fd, note, note_size, note_off) != (ssize_t)note_size) {
+		goto out;
+	}
+	if (pwrite(core_fd, core_shstrtab, sizeof(core_shstrtab),
+		   strtab_off) != sizeof(core_shstrtab)) {
+		goto out;
+	}
+	if (pwrite(core_fd, shdrs, shdrs_size,
+		   strtab_off + sizeof(core_shstrtab)) != (ssize_t)shdrs_size) {
+		goto out;
+	}
+
+	if (elfclass == ELFCLASS64) {
+		Elf64_Ehdr *ehdr = hdr;
+
+		ehdr->e_shoff = shoff;
+		ehdr->e_shentsize = shentsize;
+		ehdr->e_shnum = 4;
+		ehdr->e_shstrndx = 1;
+	} else {
+		Elf32_Ehdr *ehdr = hdr;
+
+		ehdr->e_shoff = shoff;
+		ehdr->e_shentsize = shentsize;
+		ehdr->e_shnum = 4;
+		ehdr->e_shstrndx = 1;
+	}
+
+	if (dump_offset)
+		*dump_offset = note_off;
+	*core_size = shoff + (shentsize * 4);
+
+	err = 0;
+out:
+	free(shdrs);
+	free(note);
+	return err;
+}
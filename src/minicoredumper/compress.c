@@ -0,0 +1,819 @@
+/*
+ * Copyright (c) 2012-2018 Linutronix GmbH. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Built-in streaming compressors. The compressed stream is written
+ * directly to the output file, so no external compressor process and
+ * no pipe are needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+
+#include "prog_config.h"
+#include "compress.h"
+
+#define COMPRESS_OUT_SIZE (128 * 1024)
+
+/* input size of an independently compressed block */
+#define COMPRESS_BLOCK_SIZE (1024 * 1024)
+
+/* upper limit of compression threads */
+#define COMPRESS_MAX_THREADS 64
+
+/* zstd seekable format (zstd contrib/seekable_format) */
+#define ZSTD_SKIPPABLE_MAGIC 0x184D2A5EU
+#define ZSTD_SEEKABLE_MAGIC 0x8F92EAB1U
+#define ZSTD_SEEKABLE_FOOTER_SIZE 9
+
+enum block_state {
+	BLOCK_FREE = 0,
+	BLOCK_QUEUED,
+	BLOCK_DONE,
+};
+
+/* a block of input compressed by one of the worker threads */
+struct cblock {
+	unsigned char *in;
+	size_t in_len;
+	unsigned char *out;
+	size_t out_size;
+	size_t out_len;
+	int state;
+	int err;
+};
+
+void info(const char *fmt, ...);
+
+struct compressor {
+	unsigned int method;
+	int level;
+	int fd;
+	unsigned char *out;
+	size_t out_size;
+
+	/*
+	 * Block-parallel mode: blocks are compressed by worker threads
+	 * and written in order. Block i uses slot i % nblocks.
+	 */
+	int nthreads;
+	pthread_t *threads;
+	struct cblock *blocks;
+	int nblocks;
+	unsigned long submitted;
+	unsigned long taken;
+	unsigned long written;
+	int quit;
+	int err;
+
+	/* compressed and uncompressed size of each written block */
+	int seekable;
+	uint32_t *seek_table;
+	unsigned long seek_size;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+#ifdef HAVE_LIBZSTD
+	ZSTD_CCtx *zstd;
+#endif
+#ifdef HAVE_ZLIB
+	z_stream gz;
+#endif
+#ifdef HAVE_LIBLZMA
+	lzma_stream xz;
+#endif
+};
+
+const char *compressor_name(unsigned int method)
+{
+	switch (method) {
+	case COMPRESS_ZSTD:
+		return "zstd";
+	case COMPRESS_GZIP:
+		return "gzip";
+	case COMPRESS_XZ:
+		return "xz";
+	}
+
+	return "external";
+}
+
+/* default file extension of the compressed stream */
+const char *compressor_ext(unsigned int method)
+{
+	switch (method) {
+	case COMPRESS_ZSTD:
+		return "zst";
+	case COMPRESS_GZIP:
+		return "gz";
+	case COMPRESS_XZ:
+		return "xz";
+	}
+
+	return "compressed";
+}
+
+static int write_buf(int fd, const unsigned char *buf, size_t len)
+{
+	size_t pos = 0;
+	ssize_t r;
+
+	while (pos < len) {
+		r = write(fd, buf + pos, len - pos);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			info("failed to write compressed data: %s",
+			     strerror(errno));
+			return -1;
+		}
+		pos += r;
+	}
+
+	return 0;
+}
+
+static int write_out(struct compressor *c, size_t len)
+{
+	return write_buf(c->fd, c->out, len);
+}
+
+#ifdef HAVE_LIBZSTD
+static int zstd_open(struct compressor *c, int level)
+{
+	c->zstd = ZSTD_createCCtx();
+	if (!c->zstd)
+		return -1;
+
+	if (level < 0)
+		level = ZSTD_CLEVEL_DEFAULT;
+
+	if (ZSTD_isError(ZSTD_CCtx_setParameter(c->zstd,
+						ZSTD_c_compressionLevel,
+						level))) {
+		ZSTD_freeCCtx(c->zstd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int zstd_code(struct compressor *c, const void *buf, size_t len,
+		     int finish)
+{
+	ZSTD_EndDirective mode = finish ? ZSTD_e_end : ZSTD_e_continue;
+	ZSTD_inBuffer in = { buf, len, 0 };
+	ZSTD_outBuffer out;
+	size_t ret;
+
+	do {
+		out.dst = c->out;
+		out.size = c->out_size;
+		out.pos = 0;
+
+		ret = ZSTD_compressStream2(c->zstd, &out, &in, mode);
+		if (ZSTD_isError(ret)) {
+			info("zstd compression failed: %s",
+			     ZSTD_getErrorName(ret));
+			return -1;
+		}
+
+		if (write_out(c, out.pos) != 0)
+			return -1;
+
+		/* when finishing, ret is the amount not yet flushed */
+	} while (in.pos < in.size || (finish && ret != 0));
+
+	return 0;
+}
+#endif /* HAVE_LIBZSTD */
+
+#ifdef HAVE_ZLIB
+static int gzip_open(struct compressor *c, int level)
+{
+	if (level < 0)
+		level = Z_DEFAULT_COMPRESSION;
+
+	/* windowBits + 16 selects the gzip format */
+	if (deflateInit2(&c->gz, level, Z_DEFLATED, 15 + 16, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static int gzip_code(struct compressor *c, const void *buf, size_t len,
+		     int finish)
+{
+	const unsigned char *p = buf;
+	uInt chunk;
+	int ret;
+
+	do {
+		/* avail_in is only an unsigned int */
+		chunk = len > 0x40000000 ? 0x40000000 : len;
+
+		c->gz.next_in = (unsigned char *)p;
+		c->gz.avail_in = chunk;
+		p += chunk;
+		len -= chunk;
+
+		do {
+			c->gz.next_out = c->out;
+			c->gz.avail_out = c->out_size;
+
+			ret = deflate(&c->gz, (finish && len == 0) ?
+					      Z_FINISH : Z_NO_FLUSH);
+			if (ret == Z_STREAM_ERROR) {
+				info("gzip compression failed");
+				return -1;
+			}
+
+			if (write_out(c, c->out_size - c->gz.avail_out) != 0)
+				return -1;
+		} while (c->gz.avail_out == 0);
+	} while (len > 0);
+
+	if (finish && ret != Z_STREAM_END) {
+		info("gzip compression failed to finish");
+		return -1;
+	}
+
+	return 0;
+}
+#endif /* HAVE_ZLIB */
+
+#ifdef HAVE_LIBLZMA
+static int xz_open(struct compressor *c, int level)
+{
+	lzma_stream init = LZMA_STREAM_INIT;
+
+	if (level < 0)
+		level = LZMA_PRESET_DEFAULT;
+
+	c->xz = init;
+	if (lzma_easy_encoder(&c->xz, level, LZMA_CHECK_CRC64) != LZMA_OK)
+		return -1;
+
+	return 0;
+}
+
+static int xz_code(struct compressor *c, const void *buf, size_t len,
+		   int finish)
+{
+	lzma_action action = finish ? LZMA_FINISH : LZMA_RUN;
+	lzma_ret ret;
+
+	c->xz.next_in = buf;
+	c->xz.avail_in = len;
+
+	do {
+		c->xz.next_out = c->out;
+		c->xz.avail_out = c->out_size;
+
+		ret = lzma_code(&c->xz, action);
+		if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+			info("xz compression failed: %d", ret);
+			return -1;
+		}
+
+		if (write_out(c, c->out_size - c->xz.avail_out) != 0)
+			return -1;
+	} while (c->xz.avail_in > 0 || c->xz.avail_out == 0 ||
+		 (finish && ret != LZMA_STREAM_END));
+
+	return 0;
+}
+#endif /* HAVE_LIBLZMA */
+
+/*
+ * Compress a block into a complete, independent zstd frame, gzip member
+ * or xz stream. Concatenations of these are valid files of the format
+ * (multi-frame zstd, pigz-style multi-member gzip).
+ */
+static int compress_block(struct compressor *c, struct cblock *b)
+{
+	switch (c->method) {
+#ifdef HAVE_LIBZSTD
+	case COMPRESS_ZSTD: {
+		size_t ret;
+
+		ret = ZSTD_compress(b->out, b->out_size, b->in, b->in_len,
+				    c->level < 0 ? ZSTD_CLEVEL_DEFAULT :
+						   c->level);
+		if (ZSTD_isError(ret))
+			return -1;
+		b->out_len = ret;
+		return 0;
+	}
+#endif
+#ifdef HAVE_ZLIB
+	case COMPRESS_GZIP: {
+		z_stream z;
+		int ret;
+
+		memset(&z, 0, sizeof(z));
+		if (deflateInit2(&z, c->level < 0 ? Z_DEFAULT_COMPRESSION :
+						    c->level,
+				 Z_DEFLATED, 15 + 16, 8,
+				 Z_DEFAULT_STRATEGY) != Z_OK) {
+			return -1;
+		}
+
+		z.next_in = b->in;
+		z.avail_in = b->in_len;
+		z.next_out = b->out;
+		z.avail_out = b->out_size;
+
+		ret = deflate(&z, Z_FINISH);
+		b->out_len = b->out_size - z.avail_out;
+		deflateEnd(&z);
+
+		return (ret == Z_STREAM_END ? 0 : -1);
+	}
+#endif
+#ifdef HAVE_LIBLZMA
+	case COMPRESS_XZ: {
+		size_t pos = 0;
+
+		if (lzma_easy_buffer_encode(c->level < 0 ?
+					    LZMA_PRESET_DEFAULT : c->level,
+					    LZMA_CHECK_CRC64, NULL,
+					    b->in, b->in_len, b->out,
+					    &pos, b->out_size) != LZMA_OK) {
+			return -1;
+		}
+		b->out_len = pos;
+		return 0;
+	}
+#endif
+	}
+
+	return -1;
+}
+
+static size_t compress_bound(unsigned int method, size_t len)
+{
+	switch (method) {
+#ifdef HAVE_LIBZSTD
+	case COMPRESS_ZSTD:
+		return ZSTD_compressBound(len);
+#endif
+#ifdef HAVE_ZLIB
+	case COMPRESS_GZIP:
+		/* deflateBound() plus the gzip header and trailer */
+		return compressBound(len) + 18;
+#endif
+#ifdef HAVE_LIBLZMA
+	case COMPRESS_XZ:
+		return lzma_stream_buffer_bound(len);
+#endif
+	}
+
+	return 0;
+}
+
+/* check if a built-in method was compiled in */
+int compressor_available(unsigned int method)
+{
+	return (compress_bound(method, COMPRESS_BLOCK_SIZE) != 0);
+}
+
+static void *compress_worker(void *arg)
+{
+	struct compressor *c = arg;
+	struct cblock *b;
+	int err;
+
+	pthread_mutex_lock(&c->lock);
+	while (1) {
+		while (!c->quit && c->taken == c->submitted)
+			pthread_cond_wait(&c->work_cond, &c->lock);
+
+		if (c->taken == c->submitted)
+			break;
+
+		b = &c->blocks[c->taken % c->nblocks];
+		c->taken++;
+		pthread_mutex_unlock(&c->lock);
+
+		err = compress_block(c, b);
+
+		pthread_mutex_lock(&c->lock);
+		b->err = err;
+		b->state = BLOCK_DONE;
+		pthread_cond_broadcast(&c->done_cond);
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	return NULL;
+}
+
+static int add_seek_entry(struct compressor *c, struct cblock *b)
+{
+	uint32_t *tmp;
+
+	if ((c->written % 1024) == 0) {
+		tmp = realloc(c->seek_table, (c->written + 1024) * 2 *
+					     sizeof(*tmp));
+		if (!tmp)
+			return -1;
+		c->seek_table = tmp;
+	}
+
+	c->seek_table[c->written * 2] = b->out_len;
+	c->seek_table[(c->written * 2) + 1] = b->in_len;
+	c->seek_size++;
+
+	return 0;
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/*
+ * Write the seek table as a skippable frame. Each entry holds the
+ * compressed and the uncompressed size of one frame, so any core offset
+ * can be mapped to its frame without decompressing the others.
+ */
+static int write_seek_table(struct compressor *c)
+{
+	unsigned char *buf;
+	unsigned long i;
+	size_t size;
+	int ret;
+
+	size = (c->seek_size * 8) + ZSTD_SEEKABLE_FOOTER_SIZE;
+
+	buf = malloc(size + 8);
+	if (!buf)
+		return -1;
+
+	put_le32(buf, ZSTD_SKIPPABLE_MAGIC);
+	put_le32(buf + 4, size);
+
+	for (i = 0; i < c->seek_size; i++) {
+		put_le32(buf + 8 + (i * 8), c->seek_table[i * 2]);
+		put_le32(buf + 12 + (i * 8), c->seek_table[(i * 2) + 1]);
+	}
+
+	/* footer: number of frames, descriptor (no checksums), magic */
+	put_le32(buf + 8 + (i * 8), c->seek_size);
+	buf[12 + (i * 8)] = 0;
+	put_le32(buf + 13 + (i * 8), ZSTD_SEEKABLE_MAGIC);
+
+	ret = write_buf(c->fd, buf, size + 8);
+
+	free(buf);
+
+	return ret;
+}
+
+/* wait for the oldest queued block and write it */
+static int write_next_block(struct compressor *c)
+{
+	struct cblock *b = &c->blocks[c->written % c->nblocks];
+
+	pthread_mutex_lock(&c->lock);
+	while (b->state != BLOCK_DONE)
+		pthread_cond_wait(&c->done_cond, &c->lock);
+	pthread_mutex_unlock(&c->lock);
+
+	if (b->err) {
+		info("%s block compression failed",
+		     compressor_name(c->method));
+		c->err = -1;
+	}
+
+	if (!c->err && write_buf(c->fd, b->out, b->out_len) != 0)
+		c->err = -1;
+
+	if (!c->err && c->seekable && add_seek_entry(c, b) != 0)
+		c->err = -1;
+
+	b->state = BLOCK_FREE;
+	b->in_len = 0;
+	c->written++;
+
+	return c->err;
+}
+
+static void submit_block(struct compressor *c)
+{
+	pthread_mutex_lock(&c->lock);
+	c->blocks[c->submitted % c->nblocks].state = BLOCK_QUEUED;
+	c->submitted++;
+	pthread_cond_signal(&c->work_cond);
+	pthread_mutex_unlock(&c->lock);
+}
+
+static int block_write(struct compressor *c, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	struct cblock *b;
+	size_t chunk;
+
+	while (len > 0) {
+		/* all slots busy: the oldest block must be written first */
+		if (c->submitted - c->written == (unsigned long)c->nblocks &&
+		    write_next_block(c) != 0) {
+			return -1;
+		}
+
+		b = &c->blocks[c->submitted % c->nblocks];
+
+		chunk = COMPRESS_BLOCK_SIZE - b->in_len;
+		if (chunk > len)
+			chunk = len;
+
+		memcpy(b->in + b->in_len, p, chunk);
+		b->in_len += chunk;
+		p += chunk;
+		len -= chunk;
+
+		if (b->in_len == COMPRESS_BLOCK_SIZE)
+			submit_block(c);
+	}
+
+	return c->err;
+}
+
+static void stop_threads(struct compressor *c, int nthreads)
+{
+	int i;
+
+	pthread_mutex_lock(&c->lock);
+	c->quit = 1;
+	pthread_cond_broadcast(&c->work_cond);
+	pthread_mutex_unlock(&c->lock);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(c->threads[i], NULL);
+}
+
+static void free_blocks(struct compressor *c)
+{
+	int i;
+
+	for (i = 0; i < c->nblocks; i++) {
+		free(c->blocks[i].in);
+		free(c->blocks[i].out);
+	}
+	free(c->blocks);
+	free(c->threads);
+	free(c->seek_table);
+
+	pthread_mutex_destroy(&c->lock);
+	pthread_cond_destroy(&c->work_cond);
+	pthread_cond_destroy(&c->done_cond);
+}
+
+static int block_open(struct compressor *c, int nthreads)
+{
+	size_t bound;
+	int i;
+
+	bound = compress_bound(c->method, COMPRESS_BLOCK_SIZE);
+	if (bound == 0) {
+		info("%s compression not supported",
+		     compressor_name(c->method));
+		return -1;
+	}
+
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->work_cond, NULL);
+	pthread_cond_init(&c->done_cond, NULL);
+
+	/* two blocks per thread so that reading and compressing overlap */
+	c->blocks = calloc(nthreads * 2, sizeof(*c->blocks));
+	c->threads = calloc(nthreads, sizeof(*c->threads));
+	if (!c->blocks || !c->threads)
+		goto out_err;
+	c->nblocks = nthreads * 2;
+
+	for (i = 0; i < c->nblocks; i++) {
+		c->blocks[i].in = malloc(COMPRESS_BLOCK_SIZE);
+		c->blocks[i].out = malloc(bound);
+		c->blocks[i].out_size = bound;
+		if (!c->blocks[i].in || !c->blocks[i].out)
+			goto out_err;
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&c->threads[i], NULL,
+				   compress_worker, c) != 0) {
+			stop_threads(c, i);
+			goto out_err;
+		}
+	}
+
+	c->nthreads = nthreads;
+
+	return 0;
+out_err:
+	free_blocks(c);
+	return -1;
+}
+
+static int block_close(struct compressor *c)
+{
+	struct cblock *b = &c->blocks[c->submitted % c->nblocks];
+
+	/*
+	 * Submit the partially filled block. If all slots are in flight,
+	 * there is none. An empty stream still gets one (empty) frame.
+	 */
+	if (c->submitted - c->written < (unsigned long)c->nblocks &&
+	    (b->in_len > 0 || c->submitted == 0)) {
+		submit_block(c);
+	}
+
+	while (c->written < c->submitted)
+		write_next_block(c);
+
+	stop_threads(c, c->nthreads);
+
+	if (!c->err && c->seekable && write_seek_table(c) != 0)
+		c->err = -1;
+
+	free_blocks(c);
+
+	return c->err;
+}
+
+static int code(struct compressor *c, const void *buf, size_t len,
+		int finish)
+{
+	switch (c->method) {
+#ifdef HAVE_LIBZSTD
+	case COMPRESS_ZSTD:
+		return zstd_code(c, buf, len, finish);
+#endif
+#ifdef HAVE_ZLIB
+	case COMPRESS_GZIP:
+		return gzip_code(c, buf, len, finish);
+#endif
+#ifdef HAVE_LIBLZMA
+	case COMPRESS_XZ:
+		return xz_code(c, buf, len, finish);
+#endif
+	}
+
+	return -1;
+}
+
+/*
+ * Start a compressed stream written to fd. A negative level selects the
+ * default level of the method. With more than one thread, the input is
+ * split into blocks that are compressed in parallel. A seekable stream
+ * (zstd only) is always written in blocks, followed by a seek table.
+ */
+struct compressor *compressor_open(unsigned int method, int level,
+				   int nthreads, int seekable, int fd)
+{
+	struct compressor *c;
+	int ret = -1;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+
+	c->method = method;
+	c->level = level;
+	c->fd = fd;
+
+	if (nthreads > COMPRESS_MAX_THREADS)
+		nthreads = COMPRESS_MAX_THREADS;
+
+	if (seekable) {
+		if (method != COMPRESS_ZSTD) {
+			info("seekable %s compression not supported",
+			     compressor_name(method));
+			free(c);
+			return NULL;
+		}
+		c->seekable = 1;
+		if (nthreads < 1)
+			nthreads = 1;
+	}
+
+	if (nthreads > 1 || seekable) {
+		if (block_open(c, nthreads) != 0) {
+			free(c);
+			return NULL;
+		}
+		return c;
+	}
+
+	c->out_size = COMPRESS_OUT_SIZE;
+	c->out = malloc(c->out_size);
+	if (!c->out) {
+		free(c);
+		return NULL;
+	}
+
+	switch (method) {
+#ifdef HAVE_LIBZSTD
+	case COMPRESS_ZSTD:
+		ret = zstd_open(c, level);
+		break;
+#endif
+#ifdef HAVE_ZLIB
+	case COMPRESS_GZIP:
+		ret = gzip_open(c, level);
+		break;
+#endif
+#ifdef HAVE_LIBLZMA
+	case COMPRESS_XZ:
+		ret = xz_open(c, level);
+		break;
+#endif
+	default:
+		info("%s compression not supported",
+		     compressor_name(method));
+		break;
+	}
+
+	if (ret != 0) {
+		free(c->out);
+		free(c);
+		return NULL;
+	}
+
+	return c;
+}
+
+int compressor_write(struct compressor *c, const void *buf, size_t len)
+{
+	if (len == 0)
+		return 0;
+
+	if (c->nthreads)
+		return block_write(c, buf, len);
+
+	return code(c, buf, len, 0);
+}
+
+/*
+ * Finish the compressed stream and free the compressor. The output file
+ * is not closed.
+ */
+int compressor_close(struct compressor *c)
+{
+	int ret;
+
+	if (c->nthreads) {
+		ret = block_close(c);
+		free(c);
+		return ret;
+	}
+
+	ret = code(c, NULL, 0, 1);
+
+	switch (c->method) {
+#ifdef HAVE_LIBZSTD
+	case COMPRESS_ZSTD:
+		ZSTD_freeCCtx(c->zstd);
+		break;
+#endif
+#ifdef HAVE_ZLIB
+	case COMPRESS_GZIP:
+		deflateEnd(&c->gz);
+		break;
+#endif
+#ifdef HAVE_LIBLZMA
+	case COMPRESS_XZ:
+		lzma_end(&c->xz);
+		break;
+#endif
+	}
+
+	free(c->out);
+	free(c);
+
+	return ret;
+}
@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2012-2018 Linutronix GmbH. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#include <stddef.h>
+
+struct compressor;
+
+struct compressor *compressor_open(unsigned int method, int level,
+				   int nthreads, int seekable, int fd);
+int compressor_write(struct compressor *c, const void *buf, size_t len);
+int compressor_close(struct compressor *c);
+const char *compressor_name(unsigned int method);
+int compressor_available(unsigned int method);
+const char *compressor_ext(unsigned int method);
+
+#endif /* __COMPRESS_H__ */
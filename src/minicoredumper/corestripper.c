@@ -18,9 +18,12 @@
 #include <stddef.h>
 #include <limits.h>
 #include <inttypes.h>
+#include <time.h>
+#include <endian.h>
 #include <link.h>
 #include <gelf.h>
 #include <thread_db.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
@@ -28,20 +31,25 @@
 #include <sys/procfs.h>
 #include <sys/syscall.h>
 #include <sys/ptrace.h>
+#include <sys/uio.h>
 #include <linux/futex.h>
-#include <elfutils/version.h>
 
 #include "prog_config.h"
 #include "dump_data_private.h"
 #include "minicoredumper.h"
 #include "common.h"
 #include "corestripper.h"
+#include "sym_cache.h"
+#include "compress.h"
+#include "uring.h"
 
 /* /BASEDIR/IMAGE.TIMESTAMP.PID */
 #define CORE_DIR_FMT "%s/%s.%s.%i"
 
-#if _ELFUTILS_PREREQ(0, 167)
-#define SUPPORT_LIBELF_MODIFY
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#define ELFDATA_NATIVE ELFDATA2LSB
+#else
+#define ELFDATA_NATIVE ELFDATA2MSB
 #endif
 
 #ifndef PTRACE_SEIZE
@@ -54,15 +62,60 @@
 
 /*
  * The ustar format only has 11 octal characters available for
- * specifying sizes and offsets. So the maximum value is:
+ * specifying sizes. So the maximum value is:
  *
  *       077777777777 => 8589934591
+ *
+ * Larger sizes are stored in a pax extended header.
  */
 #define USTAR_MAXVAL 8589934591
 
 static struct dump_info *global_di;
 static long PAGESZ;
 
+/* config of this invocation, shared by all dumps */
+static struct config *base_cfg;
+
+/* dump_info of the live dump worker running in this thread, if any */
+static __thread struct dump_info *worker_di;
+
+static struct dump_info *log_di(void)
+{
+	if (worker_di)
+		return worker_di;
+	return global_di;
+}
+
+/* staging buffer size and maximum number of pieces of the minicore writer */
+#define MINI_CORE_BATCH (1024 * 1024)
+#define MINI_CORE_PIECES 1024
+
+/* amount of target memory read at once by the fat core pass */
+#define FAT_PASS_CHUNK (1024 * 1024)
+
+/* number of staging buffers registered with io_uring */
+#define MINI_CORE_URING_BATCHES 4
+
+/* maximum number of areas gathered into a single process_vm_readv() */
+#define REMOTE_READ_BATCH 1024
+
+/* number of target pages kept in the remote page cache */
+#define PAGE_CACHE_SLOTS 128
+
+/* remote reads larger than this bypass the remote page cache */
+#define PAGE_CACHE_MAX_READ (PAGESZ * 4)
+
+#define PAGE_CACHE_EMPTY ((unsigned long)-1)
+
+/* maximum size (including terminator) of registered idents and formats */
+#define REMOTE_STRING_MAX 4096
+
+struct remote_read {
+	unsigned long addr;
+	void *dst;
+	size_t len;
+};
+
 struct remote_data_callbacks {
 	void *(*setup_data)(struct dump_data_elem *, void *);
 	void (*cleanup_data)(void *);
@@ -71,23 +124,26 @@ struct remote_data_callbacks {
 
 void info(const char *fmt, ...)
 {
+	struct dump_info *di;
 	va_list ap;
 
 	va_start(ap, fmt);
 	vsyslog(LOG_ERR | LOG_USER, fmt, ap);
 	va_end(ap);
 
-	if (global_di->info_file) {
+	di = log_di();
+	if (di->info_file) {
 		va_start(ap, fmt);
-		vfprintf(global_di->info_file, fmt, ap);
+		vfprintf(di->info_file, fmt, ap);
 		va_end(ap);
-		fprintf(global_di->info_file, "\n");
-		fflush(global_di->info_file);
+		fprintf(di->info_file, "\n");
+		fflush(di->info_file);
 	}
 }
 
 void fatal(const char *fmt, ...)
 {
+	struct dump_info *di;
 	va_list ap;
 	char *msg;
 
@@ -98,12 +154,13 @@ void fatal(const char *fmt, ...)
 	vsyslog(LOG_ERR | LOG_USER, msg, ap);
 	va_end(ap);
 
-	if (global_di->info_file) {
+	di = log_di();
+	if (di->info_file) {
 		va_start(ap, fmt);
-		vfprintf(global_di->info_file, msg, ap);
+		vfprintf(di->info_file, msg, ap);
 		va_end(ap);
-		fprintf(global_di->info_file, "\n");
-		fflush(global_di->info_file);
+		fprintf(di->info_file, "\n");
+		fflush(di->info_file);
 	}
 
 	exit(1);
@@ -335,30 +392,24 @@ static int dump_data_file_text(struct mcd_dump_data *dd, FILE *file,
 	return 0;
 }
 
-static int copy_file(const char *dest, const char *src)
+static FILE *open_src_file(const char *src)
 {
-	unsigned char c;
 	struct stat sb;
-	FILE *f_dest;
-	FILE *f_src;
-	int i;
 
 	if (stat(src, &sb) != 0)
-		return -1;
+		return NULL;
 
 	/* non-regular files ignored */
 	if ((sb.st_mode & S_IFMT) != S_IFREG)
-		return -1;
+		return NULL;
 
-	f_src = fopen(src, "r");
-	if (!f_src)
-		return -1;
+	return fopen(src, "r");
+}
 
-	f_dest = fopen(dest, "w");
-	if (!f_dest) {
-		fclose(f_src);
-		return -1;
-	}
+static void copy_stream(FILE *f_dest, FILE *f_src)
+{
+	unsigned char c;
+	int i;
 
 	while (1) {
 		i = fgetc(f_src);
@@ -369,6 +420,24 @@ static int copy_file(const char *dest, const char *src)
 
 		fwrite(&c, 1, 1, f_dest);
 	}
+}
+
+static int copy_file(const char *dest, const char *src)
+{
+	FILE *f_dest;
+	FILE *f_src;
+
+	f_src = open_src_file(src);
+	if (!f_src)
+		return -1;
+
+	f_dest = fopen(dest, "w");
+	if (!f_dest) {
+		fclose(f_src);
+		return -1;
+	}
+
+	copy_stream(f_dest, f_src);
 
 	fclose(f_src);
 	fclose(f_dest);
@@ -597,7 +666,11 @@ static int init_di(struct dump_info *di, int argc, char *argv[])
 	}
 
 	di->mem_fd = -1;
+	di->no_vm_readv = 0;
+	memset(&di->page_cache, 0, sizeof(di->page_cache));
 	di->elf_fd = -1;
+	di->elf_hdr = NULL;
+	di->elf_hdr_size = 0;
 	di->core_fd = -1;
 	di->fatcore_fd = -1;
 
@@ -633,21 +706,11 @@ static int init_di(struct dump_info *di, int argc, char *argv[])
 	if (!di->exe)
 		return 1;
 
-	if (argc == 8) {
-		di->cfg = init_config(MCD_CONF_PATH
-				      "/minicoredumper.cfg.json");
-	} else if (argc == 9) {
-		info("using custom minicoredumper cfg: %s", argv[8]);
-		di->cfg = init_config(argv[8]);
-	} else {
-		fatal("wrong arg count, check /proc/sys/kernel/core_pattern");
-	}
-
+	/* the config was already read by do_all_dumps() */
+	di->cfg = copy_config(base_cfg);
 	if (!di->cfg)
 		fatal("unable to init config");
 
-	check_config(di->cfg);
-
 	info("comm: %s", di->comm);
 	info("exe: %s", di->exe);
 
@@ -678,15 +741,22 @@ static int init_di(struct dump_info *di, int argc, char *argv[])
 			return 1;
 		}
 
+#ifdef HAVE_MEMFD_CREATE
+		/* anonymous, nothing to clean up if we crash */
+		di->elf_fd = memfd_create(tmp_path + 1, MFD_CLOEXEC);
+#else
 		di->elf_fd = shm_open(tmp_path, O_CREAT|O_EXCL|O_RDWR,
 				      S_IRUSR|S_IWUSR);
+#endif
 		if (di->elf_fd < 0) {
 			info("unable to create shared object \'%s\': %s", tmp_path,
 			     strerror(errno));
 			free(tmp_path);
 			return 1;
 		}
+#ifndef HAVE_MEMFD_CREATE
 		shm_unlink(tmp_path);
+#endif
 		free(tmp_path);
 
 		if (asprintf(&tmp_path, "%s/core", di->dst_dir) == -1)
@@ -732,8 +802,12 @@ static int init_di(struct dump_info *di, int argc, char *argv[])
 	if (di->mem_fd < 0) {
 		info("unable to open mem \'%s\': %s", tmp_path,
 		     strerror(errno));
-		free(tmp_path);
-		return 1;
+
+		/* the core stream can do without (if configured) */
+		if (di->core_fd < 0 || !di->cfg->prog_config.stream_core) {
+			free(tmp_path);
+			return 1;
+		}
 	}
 
 	free(tmp_path);
@@ -772,7 +846,7 @@ static int init_log(struct dump_info *di)
 typedef int elf_parse_cb(struct dump_info *di, Elf *elf, GElf_Phdr *phdr);
 
 static int do_elf_ph_parse(struct dump_info *di, GElf_Phdr *type,
-			   elf_parse_cb *callback, size_t *phnum_found)
+			   elf_parse_cb *callback)
 {
 	GElf_Ehdr ehdr_mem;
 	GElf_Ehdr *ehdr;
@@ -781,18 +855,13 @@ static int do_elf_ph_parse(struct dump_info *di, GElf_Phdr *type,
 	size_t phnum;
 	size_t cnt;
 
-	if (phnum_found)
-		*phnum_found = 0;
-
-	/* start from beginning of core */
-	if (lseek64(di->elf_fd, 0, SEEK_SET) == -1) {
-		info("lseek failed: %s", strerror(errno));
+	/* the headers of the core are mapped */
+	if (!di->elf_hdr)
 		goto out;
-	}
 
-	elf = elf_begin(di->elf_fd, ELF_C_READ, NULL);
+	elf = elf_memory(di->elf_hdr, di->elf_hdr_size);
 	if (!elf) {
-		info("elf_begin failed: %s", elf_errmsg(elf_errno()));
+		info("elf_memory failed: %s", elf_errmsg(elf_errno()));
 		goto out;
 	}
 
@@ -823,9 +892,6 @@ static int do_elf_ph_parse(struct dump_info *di, GElf_Phdr *type,
 		goto out;
 	}
 
-	if (phnum_found)
-		*phnum_found = phnum;
-
 	for (cnt = 0; cnt < phnum; cnt++) {
 		GElf_Phdr phdr_mem;
 		GElf_Phdr *phdr;
@@ -896,59 +962,141 @@ static int add_vma(struct dump_info *di, unsigned long start,
 	return 0;
 }
 
-static int vma_cb(struct dump_info *di, Elf *elf, GElf_Phdr *phdr)
+static void free_vma_index(struct dump_info *di)
 {
-	add_vma(di, phdr->p_vaddr, phdr->p_vaddr + phdr->p_memsz,
-		phdr->p_vaddr + phdr->p_filesz, phdr->p_offset, phdr->p_flags);
+	free(di->vma_index);
+	di->vma_index = NULL;
+	di->nvmas = 0;
+	di->vma_last = 0;
+}
+
+static int cmp_vma(const void *a, const void *b)
+{
+	const struct core_vma *va = *(const struct core_vma **)a;
+	const struct core_vma *vb = *(const struct core_vma **)b;
 
-	/* continue */
+	if (va->start < vb->start)
+		return -1;
+	if (va->start > vb->start)
+		return 1;
 	return 0;
 }
 
 /*
- * Tries to parse the found ELF headers and reads all vmas from it.
+ * Build an array of all vmas sorted by address.
+ * Must be called whenever the vma list changes.
  */
-static int parse_vma_info(struct dump_info *di, size_t *phnum_found)
+static int build_vma_index(struct dump_info *di)
 {
-	unsigned long min_off = ULONG_MAX;
-	unsigned long max_len = 0;
 	struct core_vma *v;
-	GElf_Phdr type;
+	int n = 0;
 
-	/* clear all existing vma info */
-	di->vma_start = 0;
-	di->vma_end = 0;
-	while (di->vma) {
-		v = di->vma;
-		di->vma = v->next;
-		free(v);
-	}
+	free_vma_index(di);
+
+	for (v = di->vma; v; v = v->next)
+		n++;
+
+	if (n == 0)
+		return 0;
 
-	/* looking for readable loadable program segments */
-	memset(&type, 0, sizeof(type));
-	type.p_type = PT_LOAD;
-	type.p_flags = PF_R | PF_W;
-	if (do_elf_ph_parse(di, &type, vma_cb, phnum_found) != 0)
+	di->vma_index = malloc(sizeof(*di->vma_index) * n);
+	if (!di->vma_index)
 		return -1;
 
-	for (v = di->vma; v; v = v->next) {
-		unsigned long len;
+	for (v = di->vma; v; v = v->next)
+		di->vma_index[di->nvmas++] = v;
 
-		/*
-		 * keep track of highest vm address
-		 * (this will be the max size of the core)
-		 */
-		len = v->file_off + v->file_end - v->start;
-		if (len > max_len)
-			max_len = len;
+	qsort(di->vma_index, di->nvmas, sizeof(*di->vma_index), cmp_vma);
 
-		/*
-		 * keep track of lowest core file offset
-		 * (all bytes up to this value will be copied from
-		 *  the source core to the core)
-		 */
-		if (v->file_off < min_off)
-			min_off = v->file_off;
+	return 0;
+}
+
+/*
+ * Read program header @i from a buffer of program headers.
+ */
+static void get_src_phdr(struct dump_info *di, const char *buf, size_t i,
+			 size_t phentsize, GElf_Phdr *phdr)
+{
+	Elf32_Phdr phdr32;
+
+	if (di->elfclass == ELFCLASS64) {
+		memcpy(phdr, buf + (i * phentsize), sizeof(*phdr));
+		return;
+	}
+
+	memcpy(&phdr32, buf + (i * phentsize), sizeof(phdr32));
+	phdr->p_type = phdr32.p_type;
+	phdr->p_flags = phdr32.p_flags;
+	phdr->p_offset = phdr32.p_offset;
+	phdr->p_vaddr = phdr32.p_vaddr;
+	phdr->p_paddr = phdr32.p_paddr;
+	phdr->p_filesz = phdr32.p_filesz;
+	phdr->p_memsz = phdr32.p_memsz;
+	phdr->p_align = phdr32.p_align;
+}
+
+/*
+ * Reads all vmas from the program headers, which are already copied to
+ * the header file. The headers are read in page-sized pieces.
+ */
+static int parse_vma_info(struct dump_info *di, off64_t phoff,
+			  size_t phentsize, size_t phnum, char *buf)
+{
+	unsigned long min_off = ULONG_MAX;
+	unsigned long max_len = 0;
+	size_t per_buf;
+	size_t cnt;
+	size_t n;
+	size_t i;
+
+	per_buf = PAGESZ / phentsize;
+
+	for (cnt = 0; cnt < phnum; cnt += n) {
+		n = phnum - cnt;
+		if (n > per_buf)
+			n = per_buf;
+
+		if (pread(di->elf_fd, buf, n * phentsize,
+			  phoff + (cnt * phentsize)) != (ssize_t)(n * phentsize)) {
+			info("failed to read program headers");
+			return -1;
+		}
+
+		for (i = 0; i < n; i++) {
+			unsigned long len;
+			GElf_Phdr phdr;
+
+			get_src_phdr(di, buf, i, phentsize, &phdr);
+
+			/* looking for readable loadable program segments */
+			if (phdr.p_type != PT_LOAD ||
+			    (phdr.p_flags & (PF_R | PF_W)) == 0) {
+				continue;
+			}
+
+			if (add_vma(di, phdr.p_vaddr,
+				    phdr.p_vaddr + phdr.p_memsz,
+				    phdr.p_vaddr + phdr.p_filesz,
+				    phdr.p_offset, phdr.p_flags) != 0) {
+				return -1;
+			}
+
+			/*
+			 * keep track of highest vm address
+			 * (this will be the max size of the core)
+			 */
+			len = phdr.p_offset + phdr.p_filesz;
+			if (len > max_len)
+				max_len = len;
+
+			/*
+			 * keep track of lowest core file offset
+			 * (all bytes up to this value will be copied from
+			 *  the source core to the core)
+			 */
+			if (phdr.p_offset < min_off)
+				min_off = phdr.p_offset;
+		}
 	}
 
 	/* sanity checks */
@@ -958,14 +1106,16 @@ static int parse_vma_info(struct dump_info *di, size_t *phnum_found)
 	di->vma_start = min_off;
 	di->vma_end = max_len;
 
-	return 0;
+	return build_vma_index(di);
 }
 
 /*
- * Copy data from a source core to (optionally) multiple destination cores.
+ * Copy data from a source core to (optionally) multiple destination cores
+ * using a userspace bounce buffer.
  * Assumes all files are already positioned correctly to begin.
  */
-static int copy_data(int src, int dest, int dest2, size_t len, char *pagebuf)
+static int copy_data_buffered(int src, int dest, int dest2, size_t len,
+			      char *pagebuf)
 {
 	size_t chunk;
 	int ret;
@@ -1016,179 +1166,1046 @@ static int copy_data(int src, int dest, int dest2, size_t len, char *pagebuf)
 	return 0;
 }
 
-struct sparse {
-	char offset[12];
-	char numbytes[12];
-};
+#if defined(HAVE_SPLICE) && defined(HAVE_COPY_FILE_RANGE)
+#define SUPPORT_ZERO_COPY
 
-struct tar_header {
-	char name[100];
-	char mode[8];
-	char uid[8];
-	char gid[8];
-	char numbytes[12];
-	char mtime[12];
-	char checksum[8];
-	char type;
-	char linkname[100];
-	char magic[6];
-	char version[2];
-	char username[32];
-	char groupname[32];
-	char dev_major[8];
-	char dev_minor[8];
-	char atime[12];
-	char ctime[12];
-	char multivolume_offset[12];
-	char longnames[4];
-	char pad0;
-	struct sparse sparse_map[4];
-	char is_extended;
-	char filesize[12];
-	char pad1[17];
-};
+/* maximum amount of data moved by a single zero-copy syscall */
+#define ZC_CHUNK_SIZE (1024 * 1024)
 
-#define BLOCK_SIZE 512
+/*
+ * Intermediate pipe used to splice between two non-pipe files. It is
+ * always empty between calls to move_data(). Each live dump worker
+ * has its own.
+ */
+static __thread int zc_pipe[2] = { -1, -1 };
 
-/* group core data items into 512-byte blocks */
-static void assign_tar_blocks(struct core_data *core_file)
+static void close_zc_pipe(void)
 {
-	struct core_data *cur;
-	off64_t blk_start;
-	off64_t blk_end;
-	int blk_id = 0;
-
-	if (!core_file)
+	if (zc_pipe[0] < 0)
 		return;
 
-	blk_start = core_file->start & ~(BLOCK_SIZE - 1);
-	blk_end = blk_start + BLOCK_SIZE;
-
-	for (cur = core_file; cur; cur = cur->next) {
-		blk_start = cur->start & ~(BLOCK_SIZE - 1);
-
-		if (blk_start > blk_end) {
-			/* new block */
-			blk_id++;
-			blk_end = blk_start + BLOCK_SIZE;
-		}
-
-		while (cur->end > blk_end)
-			blk_end += BLOCK_SIZE;
-
-		cur->blk_id = blk_id;
-	}
+	close(zc_pipe[0]);
+	close(zc_pipe[1]);
+	zc_pipe[0] = -1;
+	zc_pipe[1] = -1;
 }
 
-static struct core_data *get_tar_block_map(struct core_data *cur,
-					   off64_t *offset, off64_t *numbytes)
+static int open_zc_pipe(void)
 {
-	/* offset based on first item of block */
-	*offset = cur->start & ~(BLOCK_SIZE - 1);
+	if (zc_pipe[0] >= 0)
+		return 0;
 
-	/* skip to last item of block */
-	while (cur->next && cur->next->blk_id == cur->blk_id)
-		cur = cur->next;
+	if (pipe2(zc_pipe, O_CLOEXEC) != 0) {
+		zc_pipe[0] = -1;
+		zc_pipe[1] = -1;
+		return -1;
+	}
 
-	/* sized based on last item of block */
-	*numbytes = cur->end - *offset;
+	/* a larger pipe means fewer splice round trips (failure is ok) */
+	fcntl(zc_pipe[1], F_SETPIPE_SZ, ZC_CHUNK_SIZE);
 
-	/* return first item of next block */
-	return cur->next;
+	return 0;
 }
 
-static unsigned int get_tar_checksum(struct tar_header *header)
+/* errors that mean the kernel cannot zero-copy between these files */
+static int zc_unsupported(int err)
 {
-	char *buf = (char *)header;
-	int sum = 0;
-	int i;
-
-	for (i = 0; i < BLOCK_SIZE; i++)
-		sum += 0xff & buf[i];
+	switch (err) {
+	case EINVAL:
+	case ENOSYS:
+	case EXDEV:
+	case EOPNOTSUPP:
+	case EBADF:
+		return 1;
+	}
 
-	/*
-	 * There are only 7 characters available in the header to store the
-	 * checksum. With a block size of 512, only 6 characters are needed
-	 * for the maximal value. However, gcc does not realize this. The
-	 * final result is checked to help the compiler realize that this
-	 * function does indeed return a value that will fit in the header.
-	 * Note that this final check can never be true.
-	 */
-	if (sum > (BLOCK_SIZE * 0xff))
-		return 0;
-	return sum;
+	return 0;
 }
 
-static off64_t block_roundup(off64_t b)
+static int is_pipe(int fd)
 {
-	if ((b & (BLOCK_SIZE - 1))) {
-		b += BLOCK_SIZE;
-		b &= ~(BLOCK_SIZE - 1);
-	}
+	struct stat sb;
 
-	return b;
+	if (fstat(fd, &sb) != 0)
+		return 0;
+
+	return S_ISFIFO(sb.st_mode);
 }
 
-static int dump_zero(int fd, off64_t count)
+/*
+ * Splice exactly len bytes from the intermediate pipe to dest.
+ */
+static int drain_zc_pipe(int dest, size_t len)
 {
-	static char zero_block[4096];
-	size_t sz = sizeof(zero_block);
+	ssize_t ret;
 
-	while (count) {
-		if (count < sizeof(zero_block))
-			sz = count;
-		if (write_file_fd(fd, zero_block, sz) < 0)
+	while (len) {
+		ret = splice(zc_pipe[0], NULL, dest, NULL, len,
+			     SPLICE_F_MOVE);
+		if (ret <= 0) {
+			/* data is stuck in the pipe, do not reuse it */
+			close_zc_pipe();
 			return -1;
-		count -= sz;
+		}
+		len -= ret;
 	}
 
 	return 0;
 }
 
-/* fill the rest of the current block with zero */
-static int dump_zero_block_rest(int fd, size_t block_bytes_written)
+/*
+ * Move up to len bytes from src to dest at their current file positions
+ * without copying through userspace. Returns the number of bytes moved.
+ * On failure -1 is returned and errno is set. A return value of 0 means
+ * that src reached end-of-file.
+ */
+static ssize_t move_data(int src, int dest, size_t len, int piped,
+			 int *use_cfr)
 {
-	size_t rest;
+	ssize_t ret;
 
-	rest = BLOCK_SIZE - (block_bytes_written % BLOCK_SIZE);
+	/* one end is a pipe: the kernel can splice directly */
+	if (piped)
+		return splice(src, NULL, dest, NULL, len, SPLICE_F_MOVE);
 
-	/* check if there is a rest */
-	if (rest == BLOCK_SIZE)
-		return 0;
+	/* file to file: let the filesystem copy (or reflink) the range */
+	if (*use_cfr) {
+		ret = copy_file_range(src, NULL, dest, NULL, len, 0);
+		if (ret >= 0 || !zc_unsupported(errno))
+			return ret;
 
-	return dump_zero(fd, rest);
-}
+		/* not for these files, try splicing through a pipe */
+		*use_cfr = 0;
+	}
 
-static int open_compressor(struct dump_info *di, const char *core_suffix,
-			   char **path)
-{
-	const char *ext = di->cfg->prog_config.core_compressor_ext;
-	const char *cmd = di->cfg->prog_config.core_compressor;
-	char *tmp_path;
-	int pipefd[2];
-	pid_t pid;
-	int fd;
+	if (open_zc_pipe() != 0)
+		return -1;
 
-	*path = NULL;
+	ret = splice(src, NULL, zc_pipe[1], NULL, len, SPLICE_F_MOVE);
+	if (ret <= 0)
+		return ret;
 
-	if (asprintf(&tmp_path, "%s/core%s.%s", di->dst_dir, core_suffix,
-		     ext ? ext : "compressed") == -1) {
-		return -1;
+	if (drain_zc_pipe(dest, ret) != 0) {
+		/* the read side already moved, this is a write error */
+		errno = EIO;
+		info("write core failed at 0x%lx",
+		     lseek64(dest, 0, SEEK_CUR));
+		return -2;
 	}
 
-	fd = open(tmp_path, O_CREAT|O_RDWR, S_IRUSR|S_IWUSR);
-	if (fd == -1) {
-		info("failed to open compressed core file: %s", tmp_path);
-		free(tmp_path);
-		return -1;
-	}
+	return ret;
+}
 
-	info("executing compressor %s to create %s", cmd, tmp_path);
+/*
+ * Duplicate the len bytes just written to dest (ending at its current
+ * file position) to dest2.
+ */
+static int dup_data(int dest, int dest2, size_t len, char *pagebuf)
+{
+	off64_t off;
+	ssize_t ret;
 
-	if (pipe(pipefd) != 0) {
-		free(tmp_path);
+	off = lseek64(dest, 0, SEEK_CUR);
+	if (off == -1)
 		return -1;
-	}
+	off -= len;
+
+	while (len) {
+		ret = copy_file_range(dest, &off, dest2, NULL, len, 0);
+		if (ret > 0) {
+			len -= ret;
+			continue;
+		}
+
+		if (ret < 0 && !zc_unsupported(errno))
+			return -1;
+
+		/* read back through the bounce buffer */
+		if (lseek64(dest, off, SEEK_SET) == -1)
+			return -1;
+		ret = copy_data_buffered(dest, dest2, -1, len, pagebuf);
+		if (ret != 0)
+			return -1;
+		return 0;
+	}
+
+	return 0;
+}
+#endif /* HAVE_SPLICE && HAVE_COPY_FILE_RANGE */
+
+/*
+ * Copy data from a source core to (optionally) multiple destination cores.
+ * Assumes all files are already positioned correctly to begin.
+ *
+ * Data is moved in-kernel with splice()/copy_file_range() when possible.
+ * Only if the kernel refuses for the given files is the bounce buffer used.
+ */
+static int copy_data(int src, int dest, int dest2, size_t len, char *pagebuf)
+{
+#ifdef SUPPORT_ZERO_COPY
+	int use_cfr = 1;
+	size_t chunk;
+	ssize_t ret;
+	int piped;
+
+	/* a piped dest2 cannot be fed by reading back from dest */
+	if (dest2 >= 0 && (is_pipe(dest) || is_pipe(dest2)))
+		return copy_data_buffered(src, dest, dest2, len, pagebuf);
+
+	piped = is_pipe(src) || is_pipe(dest);
+
+	while (len) {
+		chunk = len;
+		if (chunk > ZC_CHUNK_SIZE)
+			chunk = ZC_CHUNK_SIZE;
+
+		ret = move_data(src, dest, chunk, piped, &use_cfr);
+		if (ret == -2)
+			return -1;
+
+		if (ret <= 0) {
+			if (ret < 0 && zc_unsupported(errno)) {
+				/* kernel refuses, copy the rest by hand */
+				return copy_data_buffered(src, dest, dest2,
+							  len, pagebuf);
+			}
+
+			/*
+			 * Unreadable memory or eof: let the bounce buffer
+			 * handle (skip or report) the current page.
+			 */
+			chunk = len;
+			if (chunk > (size_t)PAGESZ)
+				chunk = PAGESZ;
+			if (copy_data_buffered(src, dest, dest2, chunk,
+					       pagebuf) != 0) {
+				return -1;
+			}
+			len -= chunk;
+			continue;
+		}
+
+		if (dest2 >= 0 && dup_data(dest, dest2, ret, pagebuf) != 0) {
+			info("write core2 failed at 0x%lx",
+			     lseek64(dest2, 0, SEEK_CUR));
+			return -1;
+		}
+
+		len -= ret;
+	}
+
+	return 0;
+#else
+	return copy_data_buffered(src, dest, dest2, len, pagebuf);
+#endif
+}
+
+/*
+ * Read a source range. Unreadable pages are skipped and zero-filled,
+ * as copy_data() does.
+ */
+static int read_range(int fd, char *buf, size_t len, off64_t off)
+{
+	size_t chunk;
+	size_t pos = 0;
+	ssize_t r;
+
+	while (pos < len) {
+		r = pread(fd, buf + pos, len - pos, off + pos);
+		if (r > 0) {
+			pos += r;
+			continue;
+		}
+
+		if (r == 0) {
+			info("read core eof-failed at 0x%" PRIx64, off + pos);
+			return -1;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		info("read core failed at 0x%" PRIx64, off + pos);
+
+		/* skip the rest of this page */
+		chunk = PAGESZ - ((off + pos) % PAGESZ);
+		if (chunk > len - pos)
+			chunk = len - pos;
+		memset(buf + pos, 0, chunk);
+		pos += chunk;
+	}
+
+	return 0;
+}
+
+static int write_range(int fd, char *buf, size_t len, off64_t off)
+{
+	size_t pos = 0;
+	ssize_t r;
+
+	while (pos < len) {
+		r = pwrite(fd, buf + pos, len - pos, off + pos);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			info("write core failed at 0x%" PRIx64, off + pos);
+			return -1;
+		}
+		pos += r;
+	}
+
+	return 0;
+}
+
+/*
+ * Streaming mode. Target memory is taken from the rest of the kernel's
+ * core, which is read from the pipe in order. The data is located in the
+ * stream with the file offsets of the vmas. Data that is not needed is
+ * discarded. Requests for data that was already passed cannot be served,
+ * so once a core writer has read from the stream, no other core writer
+ * can take its place.
+ */
+static int core_stream_start(struct dump_info *di, int src)
+{
+	struct core_stream *cs;
+	off64_t pos;
+
+	/* everything up to here was copied to the header */
+	pos = lseek64(di->elf_fd, 0, SEEK_CUR);
+	if (pos == -1)
+		return -1;
+
+	cs = calloc(1, sizeof(*cs));
+	if (!cs)
+		return -1;
+
+	cs->fd = src;
+	cs->pos = pos;
+	cs->start = pos;
+	cs->null_fd = open("/dev/null", O_WRONLY);
+
+	/* the header may already contain the start of the first vma */
+	if (pos > (off64_t)di->vma_start) {
+		cs->head_start = di->vma_start;
+		cs->head_len = pos - di->vma_start;
+		cs->head = malloc(cs->head_len);
+		if (!cs->head ||
+		    pread(di->elf_fd, cs->head, cs->head_len,
+			  cs->head_start) != (ssize_t)cs->head_len) {
+			info("failed to read core stream head");
+			cs->head_len = 0;
+		}
+	}
+
+	di->stream = cs;
+
+	return 0;
+}
+
+static void core_stream_free(struct dump_info *di)
+{
+	struct core_stream *cs = di->stream;
+
+	if (!cs)
+		return;
+
+	if (cs->null_fd >= 0)
+		close(cs->null_fd);
+	free(cs->skip_buf);
+	free(cs->head);
+	free(cs);
+	di->stream = NULL;
+}
+
+/* discard len bytes of the stream */
+static int core_stream_skip(struct core_stream *cs, size_t len)
+{
+	size_t chunk;
+	ssize_t r;
+
+	while (len) {
+#ifdef HAVE_SPLICE
+		if (cs->null_fd >= 0) {
+			r = splice(cs->fd, NULL, cs->null_fd, NULL, len, 0);
+			if (r > 0) {
+				cs->pos += r;
+				len -= r;
+				continue;
+			}
+			if (r == 0)
+				return -1;
+			if (errno == EINTR)
+				continue;
+
+			/* not a pipe, read instead */
+			close(cs->null_fd);
+			cs->null_fd = -1;
+		}
+#endif
+		if (!cs->skip_buf) {
+			cs->skip_buf = malloc(PAGESZ);
+			if (!cs->skip_buf)
+				return -1;
+		}
+
+		chunk = len;
+		if (chunk > (size_t)PAGESZ)
+			chunk = PAGESZ;
+
+		r = read(cs->fd, cs->skip_buf, chunk);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		cs->pos += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+/*
+ * Read up to len bytes at the stream offset off. Returns the number of
+ * bytes read.
+ */
+static size_t core_stream_read(struct core_stream *cs, char *buf, size_t len,
+			       off64_t off)
+{
+	size_t done = 0;
+	size_t n;
+	ssize_t r;
+
+	if (off >= cs->head_start && off < cs->head_start + cs->head_len) {
+		n = cs->head_start + cs->head_len - off;
+		if (n > len)
+			n = len;
+		memcpy(buf, cs->head + (off - cs->head_start), n);
+		done += n;
+		off += n;
+	}
+
+	if (done == len || off < cs->pos)
+		return done;
+
+	if (core_stream_skip(cs, off - cs->pos) != 0)
+		return done;
+
+	while (done < len) {
+		r = read(cs->fd, buf + done, len - done);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		cs->pos += r;
+		done += r;
+	}
+
+	return done;
+}
+
+/*
+ * Read target memory. In streaming mode, it is taken from the core
+ * stream. Whatever cannot be found there is read from /proc/PID/mem.
+ * If that is not available, the read fails.
+ */
+static int read_target(struct dump_info *di, char *buf, size_t len,
+		       unsigned long addr)
+{
+	struct core_stream *cs = di->stream;
+	struct core_vma *vma;
+	size_t n;
+
+	while (cs && len) {
+		/* requests are in order, so the vmas are walked once */
+		if (cs->vma >= di->nvmas ||
+		    addr < di->vma_index[cs->vma]->start) {
+			cs->vma = 0;
+		}
+		while (cs->vma < di->nvmas &&
+		       addr >= di->vma_index[cs->vma]->mem_end) {
+			cs->vma++;
+		}
+
+		if (cs->vma >= di->nvmas)
+			break;
+		vma = di->vma_index[cs->vma];
+		if (addr < vma->start || addr >= vma->file_end)
+			break;
+
+		n = vma->file_end - addr;
+		if (n > len)
+			n = len;
+
+		n = core_stream_read(cs, buf, n,
+				     vma->file_off + (addr - vma->start));
+		buf += n;
+		addr += n;
+		len -= n;
+		if (n == 0)
+			break;
+	}
+
+	if (len == 0)
+		return 0;
+
+	if (di->mem_fd < 0) {
+		info("ERROR: target memory at 0x%lx not in core stream", addr);
+		return -1;
+	}
+
+	return read_range(di->mem_fd, buf, len, addr);
+}
+
+/*
+ * Combined fat core pass. The dumped VMAs are read in order, chunk by
+ * chunk, and each chunk is written to the fat core. The core writers
+ * take their target memory from the current chunk, so that the memory
+ * is only read once. Requests that are not ahead of the pass (or not in
+ * a dumped VMA) are not served and must be read directly.
+ */
+static int fat_pass_start(struct dump_info *di)
+{
+	struct fat_pass *fp;
+
+	if (di->nvmas == 0)
+		return -1;
+
+	fp = calloc(1, sizeof(*fp));
+	if (!fp)
+		return -1;
+
+	fp->buf = malloc(FAT_PASS_CHUNK);
+	if (!fp->buf) {
+		free(fp);
+		return -1;
+	}
+
+	fp->vma = 0;
+	fp->pos = di->vma_index[0]->start;
+	di->fat = fp;
+
+	return 0;
+}
+
+/* read the next chunk and write it to the fat core */
+static int fat_pass_next(struct dump_info *di)
+{
+	struct fat_pass *fp = di->fat;
+	struct core_vma *vma;
+	size_t len;
+
+	/* walk the vmas in address order, like the core writers */
+	while (fp->vma < di->nvmas &&
+	       fp->pos >= di->vma_index[fp->vma]->file_end) {
+		fp->vma++;
+		if (fp->vma < di->nvmas)
+			fp->pos = di->vma_index[fp->vma]->start;
+	}
+
+	if (fp->vma >= di->nvmas)
+		return -1;
+	vma = di->vma_index[fp->vma];
+
+	len = vma->file_end - fp->pos;
+	if (len > FAT_PASS_CHUNK)
+		len = FAT_PASS_CHUNK;
+
+	if (read_target(di, fp->buf, len, fp->pos) != 0 ||
+	    write_range(di->fatcore_fd, fp->buf, len,
+			vma->file_off + (fp->pos - vma->start)) != 0) {
+		/* give up, the rest is read directly */
+		fp->vma = di->nvmas;
+		fp->buf_len = 0;
+		return -1;
+	}
+
+	fp->buf_addr = fp->pos;
+	fp->buf_len = len;
+	fp->pos += len;
+
+	return 0;
+}
+
+/*
+ * Get up to @len bytes of target memory at @addr from the pass. Returns
+ * the number of bytes available at @data, or 0 if the request cannot be
+ * served.
+ */
+static size_t fat_pass_get(struct dump_info *di, unsigned long addr,
+			   size_t len, char **data)
+{
+	struct fat_pass *fp = di->fat;
+	struct core_vma *vma;
+	size_t avail;
+
+	while (addr >= fp->buf_addr + fp->buf_len) {
+		if (fp->vma >= di->nvmas || addr < fp->pos)
+			return 0;
+
+		/* only read ahead if addr is in the data still to come */
+		vma = di->vma_index[fp->vma];
+		if (fp->pos >= vma->file_end && fp->vma + 1 < di->nvmas &&
+		    addr < di->vma_index[fp->vma + 1]->start) {
+			return 0;
+		}
+
+		if (fat_pass_next(di) != 0)
+			return 0;
+	}
+
+	if (addr < fp->buf_addr)
+		return 0;
+
+	avail = fp->buf_addr + fp->buf_len - addr;
+	if (avail > len)
+		avail = len;
+	*data = fp->buf + (addr - fp->buf_addr);
+
+	return avail;
+}
+
+/* write the rest of the fat core */
+static void fat_pass_finish(struct dump_info *di)
+{
+	struct fat_pass *fp = di->fat;
+
+	while (fat_pass_next(di) == 0)
+		;
+
+	free(fp->buf);
+	free(fp);
+	di->fat = NULL;
+}
+
+/*
+ * Check if another core writer may be tried after one failed. This is
+ * not possible once the failed writer has consumed part of the core
+ * stream.
+ */
+static int core_fallback_ok(struct dump_info *di)
+{
+	struct core_stream *cs = di->stream;
+
+	if (!cs || cs->pos == cs->start)
+		return 1;
+
+	info("ERROR: core stream already consumed, no core written");
+	return 0;
+}
+
+/*
+ * Read a source range of the core, from the fat core pass if possible.
+ */
+static int read_core_src(struct dump_info *di, int fd, char *buf,
+			 size_t len, off64_t off)
+{
+	size_t n;
+	char *data;
+
+	if (di->fat && fd == di->mem_fd) {
+		while (len) {
+			n = fat_pass_get(di, off, len, &data);
+			if (n == 0)
+				break;
+			memcpy(buf, data, n);
+			buf += n;
+			off += n;
+			len -= n;
+		}
+	}
+
+	if (len == 0)
+		return 0;
+
+	if (fd == di->mem_fd)
+		return read_target(di, buf, len, off);
+
+	return read_range(fd, buf, len, off);
+}
+
+/* POSIX ustar header */
+struct tar_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char numbytes[12];
+	char mtime[12];
+	char checksum[8];
+	char type;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char username[32];
+	char groupname[32];
+	char dev_major[8];
+	char dev_minor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+#define BLOCK_SIZE 512
+
+/* a tar data block: core data items sharing 512-byte blocks */
+struct tar_block {
+	off64_t offset;
+	off64_t numbytes;
+	struct core_data *first;
+};
+
+static off64_t block_roundup(off64_t b)
+{
+	if ((b & (BLOCK_SIZE - 1))) {
+		b += BLOCK_SIZE;
+		b &= ~(BLOCK_SIZE - 1);
+	}
+
+	return b;
+}
+
+/*
+ * Group core data items into 512-byte blocks, in one walk of the core
+ * data list. Returns an array of *count blocks.
+ */
+static struct tar_block *alloc_tar_blocks(struct core_data *core_file,
+					  int *count)
+{
+	struct tar_block *blocks = NULL;
+	struct tar_block *tmp;
+	struct core_data *cur;
+	off64_t blk_start;
+	off64_t blk_end = 0;
+	int size = 0;
+	int n = 0;
+
+	for (cur = core_file; cur; cur = cur->next) {
+		blk_start = cur->start & ~(BLOCK_SIZE - 1);
+
+		if (n == 0 || blk_start > blk_end) {
+			/* new block */
+			if (n == size) {
+				size = size ? size * 2 : 64;
+				tmp = realloc(blocks, size * sizeof(*blocks));
+				if (!tmp) {
+					free(blocks);
+					return NULL;
+				}
+				blocks = tmp;
+			}
+			blocks[n].offset = blk_start;
+			blocks[n].first = cur;
+			n++;
+			blk_end = blk_start + BLOCK_SIZE;
+		}
+
+		if (cur->end > blk_end)
+			blk_end = block_roundup(cur->end);
+
+		/* sized based on last item of block */
+		blocks[n - 1].numbytes = cur->end - blocks[n - 1].offset;
+	}
+
+	/* all but the last block fill their full blocks */
+	if (n > 1) {
+		for (tmp = blocks; tmp < &blocks[n - 1]; tmp++)
+			tmp->numbytes = block_roundup(tmp->numbytes);
+	}
+
+	*count = n;
+
+	return blocks;
+}
+
+static unsigned int get_tar_checksum(struct tar_header *header)
+{
+	char *buf = (char *)header;
+	int sum = 0;
+	int i;
+
+	for (i = 0; i < BLOCK_SIZE; i++)
+		sum += 0xff & buf[i];
+
+	/*
+	 * There are only 7 characters available in the header to store the
+	 * checksum. With a block size of 512, only 6 characters are needed
+	 * for the maximal value. However, gcc does not realize this. The
+	 * final result is checked to help the compiler realize that this
+	 * function does indeed return a value that will fit in the header.
+	 * Note that this final check can never be true.
+	 */
+	if (sum > (BLOCK_SIZE * 0xff))
+		return 0;
+	return sum;
+}
+
+/* destination of a compressed core */
+struct compress_out {
+	/* pipe to the external compressor */
+	int fd;
+
+	/* or the built-in compressor writing to the file */
+	struct compressor *c;
+	int file_fd;
+
+	char *path;
+};
+
+static bool compression_enabled(struct dump_info *di)
+{
+	struct prog_config *cfg = &di->cfg->prog_config;
+
+	if (cfg->core_compress_method != COMPRESS_EXTERNAL)
+		return compressor_available(cfg->core_compress_method);
+
+	return (cfg->core_compressor != NULL);
+}
+
+/* check if the core is packed into a compressed tar */
+static bool tar_enabled(struct dump_info *di)
+{
+	struct prog_config *cfg = &di->cfg->prog_config;
+
+	/* seek tables index core offsets, so seekable cores are not tar'd */
+	if (!cfg->core_in_tar || cfg->core_compress_seekable)
+		return false;
+
+	return compression_enabled(di);
+}
+
+static int compress_write(struct compress_out *out, char *buf, size_t len)
+{
+	if (out->c)
+		return compressor_write(out->c, buf, len);
+
+	if (write_file_fd(out->fd, buf, len) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int compress_writev(struct compress_out *out, struct iovec *iov,
+			   int iovcnt)
+{
+	ssize_t r;
+	int i;
+
+	if (out->c) {
+		for (i = 0; i < iovcnt; i++) {
+			if (compressor_write(out->c, iov[i].iov_base,
+					     iov[i].iov_len) != 0) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	while (iovcnt > 0) {
+		r = writev(out->fd, iov, iovcnt);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			info("Couldn't write file fd=%d error %s", out->fd,
+			     strerror(errno));
+			return -1;
+		}
+
+		/* skip what was written */
+		while (iovcnt > 0 && (size_t)r >= iov->iov_len) {
+			r -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+	}
+
+	return 0;
+}
+
+static int dump_zero(struct compress_out *out, off64_t count)
+{
+	static char zero_block[4096];
+	size_t sz = sizeof(zero_block);
+
+	while (count) {
+		if (count < sizeof(zero_block))
+			sz = count;
+		if (compress_write(out, zero_block, sz) < 0)
+			return -1;
+		count -= sz;
+	}
+
+	return 0;
+}
+
+/* fill the rest of the current block with zero */
+static int dump_zero_block_rest(struct compress_out *out,
+				size_t block_bytes_written)
+{
+	size_t rest;
+
+	rest = BLOCK_SIZE - (block_bytes_written % BLOCK_SIZE);
+
+	/* check if there is a rest */
+	if (rest == BLOCK_SIZE)
+		return 0;
+
+	return dump_zero(out, rest);
+}
+
+/*
+ * Copy data from a source core to the compressed core.
+ * Assumes the source is already positioned correctly to begin.
+ */
+static int compress_data(int src, struct compress_out *out, size_t len,
+			 char *pagebuf)
+{
+	size_t chunk = PAGESZ;
+	int ret;
+
+	if (!out->c)
+		return copy_data(src, out->fd, -1, len, pagebuf);
+
+	while (len) {
+		if (len < chunk)
+			chunk = len;
+
+		ret = read_file_fd(src, pagebuf, chunk);
+		if (ret < 0) {
+			info("read core failed at 0x%lx",
+			     lseek64(src, 0, SEEK_CUR));
+
+			/* skip this chunk */
+			lseek64(src, chunk, SEEK_CUR);
+			memset(pagebuf, 0, chunk);
+
+		} else if (ret == 0) {
+			info("read core eof-failed at 0x%lx",
+			     lseek64(src, 0, SEEK_CUR));
+			return -1;
+		}
+
+		if (compressor_write(out->c, pagebuf, chunk) != 0)
+			return -1;
+
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+/*
+ * Copy the data of a dump list entry to the compressed core. Target
+ * memory is taken from the fat core pass if possible.
+ */
+static int compress_core_data(struct dump_info *di, struct compress_out *out,
+			      struct core_data *cur, char *pagebuf)
+{
+	size_t len = cur->end - cur->start;
+	off64_t off = cur->mem_start;
+	char *data;
+	size_t n;
+
+	if (di->fat && cur->mem_fd == di->mem_fd) {
+		while (len) {
+			n = fat_pass_get(di, off, len, &data);
+			if (n == 0)
+				break;
+			if (compress_write(out, data, n) < 0)
+				return -1;
+			off += n;
+			len -= n;
+		}
+	}
+
+	if (len == 0)
+		return 0;
+
+	if (di->stream && cur->mem_fd == di->mem_fd) {
+		while (len) {
+			n = len;
+			if (n > (size_t)PAGESZ)
+				n = PAGESZ;
+			if (read_target(di, pagebuf, n, off) != 0 ||
+			    compress_write(out, pagebuf, n) < 0) {
+				return -1;
+			}
+			off += n;
+			len -= n;
+		}
+		return 0;
+	}
+
+	if (lseek64(cur->mem_fd, off, SEEK_SET) == -1) {
+		info("lseek di->mem_fd failed at 0x%lx", off);
+		return -1;
+	}
+
+	return compress_data(cur->mem_fd, out, len, pagebuf);
+}
+
+static int open_compressor(struct dump_info *di, const char *core_suffix,
+			   struct compress_out *out)
+{
+	unsigned int method = di->cfg->prog_config.core_compress_method;
+	int level = di->cfg->prog_config.core_compress_level;
+	int threads = di->cfg->prog_config.core_compress_threads;
+	bool seekable = di->cfg->prog_config.core_compress_seekable;
+	const char *ext = di->cfg->prog_config.core_compressor_ext;
+	const char *cmd = di->cfg->prog_config.core_compressor;
+	char *tmp_path;
+	int pipefd[2];
+	pid_t pid;
+	int fd;
+
+	memset(out, 0, sizeof(*out));
+	out->fd = -1;
+	out->file_fd = -1;
+
+	if (!ext)
+		ext = compressor_ext(method);
+
+	if (asprintf(&tmp_path, "%s/core%s.%s", di->dst_dir, core_suffix,
+		     ext) == -1) {
+		return -1;
+	}
+
+	fd = open(tmp_path, O_CREAT|O_RDWR, S_IRUSR|S_IWUSR);
+	if (fd == -1) {
+		info("failed to open compressed core file: %s", tmp_path);
+		free(tmp_path);
+		return -1;
+	}
+
+	if (method != COMPRESS_EXTERNAL) {
+		/* 0 means one thread per online cpu */
+		if (threads == 0)
+			threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+		info("%s compressing with %d thread(s) to create %s",
+		     compressor_name(method), threads, tmp_path);
+
+		out->c = compressor_open(method, level, threads, seekable, fd);
+		if (!out->c) {
+			close(fd);
+			unlink(tmp_path);
+			free(tmp_path);
+			return -1;
+		}
+
+		out->file_fd = fd;
+		out->path = tmp_path;
+		return 0;
+	}
+
+	info("executing compressor %s to create %s", cmd, tmp_path);
+
+	if (pipe(pipefd) != 0) {
+		free(tmp_path);
+		return -1;
+	}
 
 	pid = fork();
 	if (pid == -1) {
@@ -1203,549 +2220,1103 @@ static int open_compressor(struct dump_info *di, const char *core_suffix,
 		signal(SIGPIPE, SIG_IGN);
 		close(fd);
 		close(pipefd[0]);
-		*path = tmp_path;
-		return pipefd[1];
+		out->fd = pipefd[1];
+		out->path = tmp_path;
+		return 0;
+	}
+
+	/* child */
+	close(pipefd[1]);
+
+	dup2(pipefd[0], STDIN_FILENO);
+	dup2(fd, STDOUT_FILENO);
+
+	execlp(cmd, cmd, NULL);
+
+	info("failed to execute compressor: %s", cmd);
+	exit(1);
+}
+
+static int close_compressor(struct compress_out *out)
+{
+	int err = 0;
+
+	if (out->c) {
+		err = compressor_close(out->c);
+		if (close(out->file_fd) != 0)
+			err = -1;
+		out->c = NULL;
+		out->file_fd = -1;
+		return err;
+	}
+
+	if (out->fd >= 0) {
+		close(out->fd);
+		wait(NULL);
+		signal(SIGPIPE, SIG_DFL);
+		out->fd = -1;
+	}
+
+	return err;
+}
+
+static void init_tar_header(struct tar_header *hdr, const char *name,
+			    char type, off64_t numbytes, time_t mtime)
+{
+	memset(hdr, 0, sizeof(*hdr));
+
+	/* larger sizes are given by the pax header */
+	if (numbytes > USTAR_MAXVAL)
+		numbytes = 0;
+
+	snprintf(hdr->name, sizeof(hdr->name), "%s", name);
+	snprintf(hdr->mode, sizeof(hdr->mode), "%07o", 0644);
+	snprintf(hdr->uid, sizeof(hdr->uid), "%07o", 0);
+	snprintf(hdr->gid, sizeof(hdr->gid), "%07o", 0);
+	snprintf(hdr->numbytes, sizeof(hdr->numbytes), "%011" PRIo64,
+		 numbytes);
+	snprintf(hdr->mtime, sizeof(hdr->mtime), "%011llo",
+		 (long long)mtime);
+	memset(hdr->checksum, ' ', sizeof(hdr->checksum));
+	hdr->type = type;
+	memcpy(hdr->magic, "ustar", 6);
+	memcpy(hdr->version, "00", 2);
+	snprintf(hdr->username, sizeof(hdr->username), "root");
+	snprintf(hdr->groupname, sizeof(hdr->groupname), "root");
+
+	/* calculate checksum */
+	snprintf(hdr->checksum, sizeof(hdr->checksum),
+		 "%06o", get_tar_checksum(hdr));
+}
+
+/*
+ * Append a pax record "<len> <key>=<value>\n". The length includes the
+ * length digits themselves.
+ */
+static int add_pax_record(char *buf, size_t *pos, size_t size,
+			  const char *key, const char *value)
+{
+	size_t base = strlen(key) + strlen(value) + 3;
+	size_t len = base + 1;
+	int ret;
+
+	while (len != base + snprintf(NULL, 0, "%zu", len))
+		len = base + snprintf(NULL, 0, "%zu", len);
+
+	if (*pos + len >= size)
+		return -1;
+
+	ret = snprintf(buf + *pos, size - *pos, "%zu %s=%s\n",
+		       len, key, value);
+	if (ret < 0 || (size_t)ret != len)
+		return -1;
+
+	*pos += len;
+
+	return 0;
+}
+
+/*
+ * Write the core file into a compressed tar archive using the GNU sparse
+ * 1.0 pax format. A pax extended header announces the sparse file, and
+ * the file data begins with the sparse map in decimal text:
+ *
+ *   <number of blocks>\n
+ *   <offset>\n<numbytes>\n   (per block)
+ *
+ * padded to a full tar block, followed by the data of all blocks. All
+ * offsets and sizes are unlimited decimal numbers.
+ */
+static int dump_compressed_tar(struct dump_info *di)
+{
+	char pax[BLOCK_SIZE * 2];
+	struct tar_header pax_hdr;
+	struct tar_block *blocks;
+	struct core_data *end;
+	struct tar_header hdr;
+	struct core_data *cur;
+	struct compress_out out;
+	struct iovec iov[4];
+	off64_t total_bytes;
+	off64_t block_bytes;
+	off64_t content;
+	off64_t offset;
+	size_t map_start;
+	size_t map_size;
+	size_t map_len;
+	size_t pax_len;
+	char *map = NULL;
+	char *buf = NULL;
+	int nentries;
+	time_t mtime;
+	char val[32];
+	int nblocks;
+	int err = -1;
+	int len;
+	int i;
+
+	if (!tar_enabled(di))
+		return -1;
+
+	blocks = alloc_tar_blocks(di->core_file, &nblocks);
+	if (!blocks)
+		return -1;
+
+	buf = malloc(PAGESZ);
+	if (!buf)
+		goto out_free;
+
+	/*
+	 * 2 decimal numbers of at most 20 digits per entry, plus the
+	 * entry count and the padding to a full block
+	 */
+	map_size = (((size_t)nblocks + 2) * 2 * 21) + BLOCK_SIZE;
+	map = calloc(1, map_size);
+	if (!map)
+		goto out_free;
+
+	/* generate the sparse map, leaving room for the entry count */
+	map_len = 21;
+	total_bytes = 0;
+	for (i = 0; i < nblocks; i++) {
+		map_len += sprintf(map + map_len, "%" PRId64 "\n%" PRId64 "\n",
+				   blocks[i].offset, blocks[i].numbytes);
+		total_bytes += blocks[i].numbytes;
+	}
+	nentries = nblocks;
+
+	/* a trailing hole is marked by an empty entry at the end */
+	if (blocks[nblocks - 1].offset + blocks[nblocks - 1].numbytes <
+	    di->core_file_size) {
+		map_len += sprintf(map + map_len, "%" PRIu64 "\n0\n",
+				   di->core_file_size);
+		nentries++;
+	}
+
+	/* put the entry count directly in front of the entries */
+	len = snprintf(val, sizeof(val), "%d\n", nentries);
+	map_start = 21 - len;
+	memcpy(map + map_start, val, len);
+	map_len = block_roundup(map_len - map_start);
+	content = map_len + total_bytes;
+
+	/* generate the pax extended header */
+	pax_len = 0;
+	if (add_pax_record(pax, &pax_len, sizeof(pax),
+			   "GNU.sparse.major", "1") != 0 ||
+	    add_pax_record(pax, &pax_len, sizeof(pax),
+			   "GNU.sparse.minor", "0") != 0 ||
+	    add_pax_record(pax, &pax_len, sizeof(pax),
+			   "GNU.sparse.name", "core") != 0) {
+		goto out_free;
+	}
+	snprintf(val, sizeof(val), "%" PRIu64, di->core_file_size);
+	if (add_pax_record(pax, &pax_len, sizeof(pax),
+			   "GNU.sparse.realsize", val) != 0) {
+		goto out_free;
+	}
+	if (content > USTAR_MAXVAL) {
+		snprintf(val, sizeof(val), "%" PRIu64, content);
+		if (add_pax_record(pax, &pax_len, sizeof(pax),
+				   "size", val) != 0) {
+			goto out_free;
+		}
+	}
+
+	/* the pax records are followed by zeros up to a full block */
+	memset(pax + pax_len, 0, block_roundup(pax_len) - pax_len);
+
+	mtime = time(NULL);
+	init_tar_header(&pax_hdr, "./PaxHeaders/core", 'x', pax_len, mtime);
+	init_tar_header(&hdr, "./GNUSparseFile.0/core", '0', content, mtime);
+
+	if (open_compressor(di, ".tar", &out) != 0)
+		goto out_free;
+
+	/* write pax header, file header and sparse map at once */
+	iov[0].iov_base = &pax_hdr;
+	iov[0].iov_len = sizeof(pax_hdr);
+	iov[1].iov_base = pax;
+	iov[1].iov_len = block_roundup(pax_len);
+	iov[2].iov_base = &hdr;
+	iov[2].iov_len = sizeof(hdr);
+	iov[3].iov_base = map + map_start;
+	iov[3].iov_len = map_len;
+	if (compress_writev(&out, iov, 4) < 0)
+		goto out;
+
+	/* write data blocks */
+	for (i = 0; i < nblocks; i++) {
+		end = (i + 1 < nblocks) ? blocks[i + 1].first : NULL;
+		offset = blocks[i].offset;
+		block_bytes = 0;
+
+		for (cur = blocks[i].first; cur != end; cur = cur->next) {
+			if (cur->start != offset) {
+				/* fill to beginning of block part */
+				if (dump_zero(&out, cur->start - offset) < 0)
+					goto out;
+				block_bytes += cur->start - offset;
+			}
+
+			if (compress_core_data(di, &out, cur, buf) < 0)
+				goto out;
+			block_bytes += cur->end - cur->start;
+			offset = cur->end;
+		}
+
+		/* fill to end of block */
+		if (dump_zero_block_rest(&out, block_bytes) < 0)
+			goto out;
+	}
+
+	/* 2 empty blocks as EOF */
+	if (dump_zero(&out, BLOCK_SIZE * 2) < 0)
+		goto out;
+
+	err = 0;
+out:
+	if (close_compressor(&out) != 0)
+		err = -1;
+	if (err) {
+		unlink(out.path);
+	} else {
+		di->cfg->prog_config.core_compressed = true;
+		info("compressed core tar path: %s", out.path);
 	}
+	free(out.path);
+out_free:
+	free(blocks);
+	free(map);
+	free(buf);
 
-	/* child */
-	close(pipefd[1]);
+	return err;
+}
 
-	dup2(pipefd[0], STDIN_FILENO);
-	dup2(fd, STDOUT_FILENO);
+/*
+ * Open the extent map of a sparse compressed core. Each line lists the
+ * core offset, the length and the offset in the uncompressed stream of
+ * one extent (in hex). The last line is an empty extent at the end of
+ * the core.
+ */
+static FILE *open_extent_map(struct dump_info *di, char **path)
+{
+	FILE *f;
 
-	execlp(cmd, cmd, NULL);
+	if (asprintf(path, "%s/core.extents", di->dst_dir) == -1) {
+		*path = NULL;
+		return NULL;
+	}
 
-	info("failed to execute compressor: %s", cmd);
-	exit(1);
-}
+	f = fopen(*path, "w");
+	if (!f) {
+		info("failed to open extent map: %s", *path);
+		free(*path);
+		*path = NULL;
+	}
 
-static void close_compressor(int fd)
-{
-	close(fd);
-	wait(NULL);
-	signal(SIGPIPE, SIG_DFL);
+	return f;
 }
 
-static int dump_compressed_tar(struct dump_info *di)
+static int dump_compressed_core(struct dump_info *di)
 {
-	struct core_data *extended_data = NULL;
-	struct core_data *next_block;
-	size_t block_bytes_written;
-	struct tar_header hdr;
+	unsigned int method = di->cfg->prog_config.core_compress_method;
+	bool sparse = di->cfg->prog_config.core_compress_sparse;
+	char *map_path = NULL;
+	struct compress_out out;
 	struct core_data *cur;
-	off64_t total_bytes;
-	char *path = NULL;
-	off64_t numbytes;
-	off64_t offset;
+	off64_t stream_pos = 0;
+	FILE *map = NULL;
+	off64_t pos = 0;
 	int err = -1;
 	char *buf;
-	int fd;
-	int i;
 
-	if (!di->cfg->prog_config.core_in_tar)
-		return -1;
-	if (!di->cfg->prog_config.core_compressor)
+	if (!compression_enabled(di)) {
+		if (method != COMPRESS_EXTERNAL) {
+			info("%s compression not supported",
+			     compressor_name(method));
+		}
 		return -1;
+	}
 
 	buf = malloc(PAGESZ);
 	if (!buf)
 		return -1;
 
-	memset(&hdr, 0, sizeof(hdr));
+	if (sparse) {
+		map = open_extent_map(di, &map_path);
+		if (!map)
+			goto out_free;
+	}
 
-	assign_tar_blocks(di->core_file);
+	if (open_compressor(di, "", &out) != 0)
+		goto out_free;
 
-	/* fill header */
+	for (cur = di->core_file; cur; cur = cur->next) {
+		if (cur->start < pos) {
+			info("invalid core data ordering");
+			goto out;
+		}
 
-	snprintf(hdr.name, sizeof(hdr.name), "core");
-	snprintf(hdr.mode, sizeof(hdr.mode), "%07o", 0644);
-	snprintf(hdr.uid, sizeof(hdr.uid), "%07o", 0);
-	snprintf(hdr.gid, sizeof(hdr.gid), "%07o", 0);
-	snprintf(hdr.mtime, sizeof(hdr.mtime), "%011llo",
-		 (long long)time(NULL));
-	memset(hdr.checksum, ' ', sizeof(hdr.checksum));
-	hdr.type = 'S';
-	memcpy(hdr.magic, "ustar ", 6);
-	hdr.version[0] = ' ';
-	snprintf(hdr.username, sizeof(hdr.username), "root");
-	snprintf(hdr.groupname, sizeof(hdr.groupname), "root");
+		if (sparse) {
+			/* record the extent instead of writing the hole */
+			fprintf(map, "%" PRIx64 " %" PRIx64 " %" PRIx64 "\n",
+				cur->start, cur->end - cur->start, stream_pos);
+			stream_pos += cur->end - cur->start;
+		} else if (dump_zero(&out, cur->start - pos) < 0) {
+			goto out;
+		}
 
-	total_bytes = 0;
-	next_block = di->core_file;
-	for (i = 0; next_block; i++) {
-		next_block = get_tar_block_map(next_block, &offset, &numbytes);
-		/* if this is not the last block, fill the full block */
-		if (next_block)
-			numbytes = block_roundup(numbytes);
-		/* dump sparse header */
-		if (i < 4) {
-			snprintf(hdr.sparse_map[i].offset,
-				 sizeof(hdr.sparse_map[i].offset),
-				 "%011" PRIo64, offset);
-			snprintf(hdr.sparse_map[i].numbytes,
-				 sizeof(hdr.sparse_map[i].numbytes),
-				 "%011" PRIo64, numbytes);
-
-			/* save first extended sparse block for later */
-			if (i == 3)
-				extended_data = next_block;
-		}
-		total_bytes += numbytes;
-	}
-
-	snprintf(hdr.numbytes, sizeof(hdr.numbytes), "%011" PRIo64,
-		 total_bytes);
-
-	if (extended_data)
-		hdr.is_extended = 1;
-	snprintf(hdr.filesize, sizeof(hdr.filesize),
-		 "%011" PRIo64, di->core_file_size);
+		if (compress_core_data(di, &out, cur, buf) < 0)
+			goto out;
 
-	/* calculate checksum */
-	snprintf(hdr.checksum, sizeof(hdr.checksum),
-		 "%06o", get_tar_checksum(&hdr));
+		pos = cur->end;
+	}
 
-	fd = open_compressor(di, ".tar", &path);
-	if (fd < 0)
+	if (sparse) {
+		fprintf(map, "%" PRIx64 " 0 %" PRIx64 "\n",
+			di->core_file_size, stream_pos);
+	} else if (pos < di->core_file_size &&
+		   dump_zero(&out, di->core_file_size - pos) < 0) {
 		goto out;
+	}
 
-	/* write header */
-	if (write_file_fd(fd, (char *)&hdr, sizeof(hdr)) < 0)
-		goto out;
+	err = 0;
+out:
+	if (map) {
+		if (fclose(map) != 0)
+			err = -1;
+		map = NULL;
+	}
+	if (close_compressor(&out) != 0)
+		err = -1;
+	if (err) {
+		unlink(out.path);
+	} else {
+		di->cfg->prog_config.core_compressed = true;
+		info("compressed core path: %s", out.path);
+	}
+	free(out.path);
+out_free:
+	if (map)
+		fclose(map);
+	if (map_path) {
+		if (err)
+			unlink(map_path);
+		else
+			info("core extent map path: %s", map_path);
+		free(map_path);
+	}
+	free(buf);
 
-	/* write extended sparse header */
-	while (extended_data) {
-		struct sparse s;
-
-		block_bytes_written = 0;
-		next_block = extended_data;
-		for (i = 0; next_block && i < 21; i++) {
-			next_block = get_tar_block_map(next_block, &offset,
-						       &numbytes);
-
-			/* if this is not the last block, fill full block */
-			if (next_block)
-				numbytes = block_roundup(numbytes);
-
-			snprintf(s.offset, sizeof(s.offset), "%011" PRIo64,
-				 offset);
-			snprintf(s.numbytes, sizeof(s.numbytes),
-				 "%011" PRIo64, numbytes);
-			if (write_file_fd(fd, (char *)&s, sizeof(s)) < 0)
-				goto out;
-			block_bytes_written += sizeof(s);
-		}
-		extended_data = next_block;
-		if (extended_data) {
-			char c = 1;
-			if (write_file_fd(fd, &c, sizeof(c)) < 0)
-				goto out;
-			block_bytes_written += 1;
+	return err;
+}
+
+/* a piece of core data staged for the minicore */
+struct mini_copy {
+	int src_fd;
+	off64_t src_off;
+	off64_t dst_off;
+	size_t len;
+	size_t buf_off;
+};
+
+/* end of the run of pieces starting at @i with contiguous source ranges */
+static int src_run_end(struct mini_copy *mc, int n, int i, size_t *len)
+{
+	int j;
+
+	*len = mc[i].len;
+	for (j = i + 1; j < n; j++) {
+		if (mc[j].src_fd != mc[i].src_fd ||
+		    mc[j].src_off != mc[j - 1].src_off + mc[j - 1].len) {
+			break;
 		}
-		/* fill to end of block */
-		if (dump_zero_block_rest(fd, block_bytes_written) < 0)
-			goto out;
+		*len += mc[j].len;
 	}
 
-	/* write data blocks */
-	block_bytes_written = 0;
-	next_block = get_tar_block_map(di->core_file, &offset, &numbytes);
-	for (cur = di->core_file; cur; cur = cur->next) {
-		if (cur == next_block) {
-			if (block_bytes_written % BLOCK_SIZE != 0) {
-				/* fill to end of block */
-				if (dump_zero_block_rest(fd,
-				    block_bytes_written) < 0) {
-					goto out;
-				}
-			}
-			next_block = get_tar_block_map(next_block, &offset,
-						       &numbytes);
-			block_bytes_written = 0;
-		}
+	return j;
+}
 
-		if (lseek64(cur->mem_fd, cur->mem_start, SEEK_SET) == -1) {
-			info("lseek di->mem_fd failed at 0x%lx",
-			     cur->mem_start);
-			goto out;
-		}
+/* end of the run of pieces starting at @i with contiguous core ranges */
+static int dst_run_end(struct mini_copy *mc, int n, int i, size_t *len)
+{
+	int j;
 
-		if (cur->start != offset) {
-			/* fill to beginning of block part */
-			if (dump_zero(fd, cur->start - offset) < 0)
-				goto out;
-			block_bytes_written += cur->start - offset;
+	*len = mc[i].len;
+	for (j = i + 1; j < n; j++) {
+		if (mc[j].dst_off != mc[j - 1].dst_off + mc[j - 1].len)
+			break;
+		*len += mc[j].len;
+	}
+
+	return j;
+}
+
+/*
+ * Copy the staged pieces. Pieces with contiguous source ranges are read
+ * with a single pread() and pieces with contiguous core ranges are
+ * written with a single pwrite(). Since the pieces are staged back to
+ * back, each such run is also contiguous in the buffer.
+ */
+static int flush_mini_copy(struct dump_info *di, struct mini_copy *mc,
+			   int n, char *buf)
+{
+	size_t len;
+	int i;
+	int j;
+
+	for (i = 0; i < n; i = j) {
+		j = src_run_end(mc, n, i, &len);
+		if (read_core_src(di, mc[i].src_fd, buf + mc[i].buf_off, len,
+				  mc[i].src_off) != 0) {
+			return -1;
 		}
+	}
 
-		if (copy_data(cur->mem_fd, fd, -1,
-		    cur->end - cur->start, buf) < 0) {
-			goto out;
+	for (i = 0; i < n; i = j) {
+		j = dst_run_end(mc, n, i, &len);
+		if (write_range(di->core_fd, buf + mc[i].buf_off, len,
+				mc[i].dst_off) != 0) {
+			return -1;
 		}
-		block_bytes_written += cur->end - cur->start;
-		offset = cur->end;
 	}
 
-	/* fill to end of block */
-	if (dump_zero_block_rest(fd, block_bytes_written) < 0)
-		goto out;
+	return 0;
+}
 
-	/* 2 empty blocks as EOF */
-	if (dump_zero(fd, BLOCK_SIZE * 2) < 0)
-		goto out;
+/* a staging buffer of the minicore writer */
+struct mini_batch {
+	char *buf;
+	struct mini_copy *mc;
+	int n;
+	size_t len;
 
-	err = 0;
+	/* number of requests in flight */
+	int pending;
+	bool writing;
+};
 
-	di->cfg->prog_config.core_compressed = true;
+/*
+ * With io_uring, each batch is first read and then written. While one
+ * batch is being written, the next ones are already being read, so that
+ * reading the target memory overlaps with writing the core file. Without
+ * io_uring, only the first batch is used and is copied synchronously.
+ */
+struct mini_writer {
+	struct uring *u;
+	struct mini_batch b[MINI_CORE_URING_BATCHES];
+	int nbatches;
+	int cur;
+	bool err;
+};
 
-	info("compressed core tar path: %s", path);
-out:
-	if (fd >= 0)
-		close_compressor(fd);
-	if (path) {
-		if (err)
-			unlink(path);
-		free(path);
+/* the ring never has more requests than pieces staged in all batches */
+static void mini_uring_open(struct dump_info *di, struct mini_writer *w)
+{
+	struct iovec iov[MINI_CORE_URING_BATCHES];
+	int i;
+
+	for (i = 1; i < MINI_CORE_URING_BATCHES; i++) {
+		w->b[i].buf = malloc(MINI_CORE_BATCH);
+		w->b[i].mc = malloc(MINI_CORE_PIECES * sizeof(*w->b[i].mc));
+		if (!w->b[i].buf || !w->b[i].mc)
+			goto out_fallback;
 	}
-	free(buf);
 
-	return err;
+	for (i = 0; i < MINI_CORE_URING_BATCHES; i++) {
+		iov[i].iov_base = w->b[i].buf;
+		iov[i].iov_len = MINI_CORE_BATCH;
+	}
+
+	w->u = uring_open(MINI_CORE_URING_BATCHES * MINI_CORE_PIECES, iov,
+			  MINI_CORE_URING_BATCHES);
+	if (!w->u)
+		goto out_fallback;
+
+	w->nbatches = MINI_CORE_URING_BATCHES;
+	return;
+
+out_fallback:
+	info("io_uring unavailable, using synchronous I/O");
+	for (i = 1; i < MINI_CORE_URING_BATCHES; i++) {
+		free(w->b[i].mc);
+		free(w->b[i].buf);
+		w->b[i].mc = NULL;
+		w->b[i].buf = NULL;
+	}
 }
 
-static int dump_compressed_core(struct dump_info *di)
+/* the tag of a request is the batch index and the first piece of the run */
+static uint64_t mini_tag(int batch, int piece)
 {
-	struct core_data *cur;
-	char *path = NULL;
-	off64_t pos = 0;
-	int err = -1;
-	char *buf;
-	int fd;
+	return ((uint64_t)batch << 32) | piece;
+}
 
-	if (!di->cfg->prog_config.core_compressor)
-		return -1;
+static void mini_queue_writes(struct dump_info *di, struct mini_writer *w,
+			      int batch)
+{
+	struct mini_batch *b = &w->b[batch];
+	size_t len;
+	int i;
+	int j;
 
-	buf = malloc(PAGESZ);
-	if (!buf)
+	b->writing = true;
+
+	for (i = 0; i < b->n; i = j) {
+		j = dst_run_end(b->mc, b->n, i, &len);
+		if (uring_queue_write(w->u, di->core_fd,
+				      b->buf + b->mc[i].buf_off, len,
+				      b->mc[i].dst_off, batch,
+				      mini_tag(batch, i)) != 0) {
+			w->err = true;
+			break;
+		}
+		b->pending++;
+	}
+}
+
+static void mini_queue_reads(struct mini_writer *w, int batch)
+{
+	struct mini_batch *b = &w->b[batch];
+	size_t len;
+	int i;
+	int j;
+
+	b->writing = false;
+
+	for (i = 0; i < b->n; i = j) {
+		j = src_run_end(b->mc, b->n, i, &len);
+		if (uring_queue_read(w->u, b->mc[i].src_fd,
+				     b->buf + b->mc[i].buf_off, len,
+				     b->mc[i].src_off, batch,
+				     mini_tag(batch, i)) != 0) {
+			w->err = true;
+			break;
+		}
+		b->pending++;
+	}
+}
+
+/*
+ * Wait for one request to complete. Failed or short requests are
+ * finished synchronously, which also takes care of zero-filling
+ * unreadable pages. Once all reads of a batch are done, its writes are
+ * queued. Once all writes are done, the batch is free again. After an
+ * error, completions are only collected. Returns -1 if waiting failed.
+ */
+static int mini_uring_reap(struct dump_info *di, struct mini_writer *w)
+{
+	struct mini_batch *b;
+	uint64_t tag;
+	size_t len;
+	int res;
+	int i;
+
+	if (uring_wait(w->u, &tag, &res) != 0) {
+		info("io_uring wait failed");
+		w->err = true;
 		return -1;
+	}
 
-	fd = open_compressor(di, "", &path);
-	if (fd < 0)
+	b = &w->b[tag >> 32];
+	i = tag & 0xffffffff;
+	b->pending--;
+
+	if (w->err)
 		goto out;
 
-	for (cur = di->core_file; cur; cur = cur->next) {
-		if (lseek64(cur->mem_fd, cur->mem_start, SEEK_SET) == -1) {
-			info("lseek di->mem_fd failed at 0x%lx",
-			     cur->mem_start);
+	if (res < 0)
+		res = 0;
+
+	if (!b->writing) {
+		src_run_end(b->mc, b->n, i, &len);
+		if ((size_t)res < len &&
+		    read_range(b->mc[i].src_fd, b->buf + b->mc[i].buf_off + res,
+			       len - res, b->mc[i].src_off + res) != 0) {
+			w->err = true;
 			goto out;
 		}
 
-		if (cur->start < pos) {
-			info("invalid core data ordering");
+		if (b->pending == 0)
+			mini_queue_writes(di, w, tag >> 32);
+	} else {
+		dst_run_end(b->mc, b->n, i, &len);
+		if ((size_t)res < len &&
+		    write_range(di->core_fd, b->buf + b->mc[i].buf_off + res,
+				len - res, b->mc[i].dst_off + res) != 0) {
+			w->err = true;
 			goto out;
 		}
+	}
+out:
+	if (b->pending == 0) {
+		b->writing = false;
+		b->n = 0;
+		b->len = 0;
+	}
 
-		dump_zero(fd, cur->start - pos);
+	return 0;
+}
 
-		if (copy_data(cur->mem_fd, fd, -1,
-			      cur->end - cur->start, buf) < 0) {
-			goto out;
-		}
+/* copy the current batch and switch to a free one */
+static int mini_flush(struct dump_info *di, struct mini_writer *w)
+{
+	struct mini_batch *b = &w->b[w->cur];
+	int i;
 
-		pos = cur->end;
+	if (!w->u) {
+		if (flush_mini_copy(di, b->mc, b->n, b->buf) != 0)
+			return -1;
+		b->n = 0;
+		b->len = 0;
+		return 0;
 	}
 
-	if (pos < di->core_file_size)
-		dump_zero(fd, di->core_file_size - pos);
+	if (b->n > 0 && !w->err)
+		mini_queue_reads(w, w->cur);
 
-	err = 0;
-
-	di->cfg->prog_config.core_compressed = true;
+	while (!w->err) {
+		for (i = 0; i < w->nbatches; i++) {
+			if (w->b[i].n == 0) {
+				w->cur = i;
+				return 0;
+			}
+		}
 
-	info("compressed core path: %s", path);
-out:
-	if (fd >= 0)
-		close_compressor(fd);
-	if (path) {
-		if (err)
-			unlink(path);
-		free(path);
+		if (mini_uring_reap(di, w) != 0)
+			break;
 	}
-	free(buf);
 
-	return err;
+	return -1;
+}
+
+/* wait until no request uses the buffers anymore */
+static void mini_drain(struct dump_info *di, struct mini_writer *w)
+{
+	int i;
+
+	for (i = 0; i < w->nbatches; i++) {
+		while (w->b[i].pending > 0) {
+			if (mini_uring_reap(di, w) != 0)
+				return;
+		}
+	}
 }
 
 static void dump_mini_core(struct dump_info *di)
 {
+	struct mini_writer w;
+	struct mini_batch *b;
 	struct core_data *cur;
-	char *buf;
+	off64_t done;
+	size_t chunk;
+	int i;
 
-	buf = malloc(PAGESZ);
-	if (!buf)
-		return;
+	memset(&w, 0, sizeof(w));
+	w.nbatches = 1;
 
-	/* set core size */
-	if (pwrite(di->core_fd, "", 1, di->core_file_size - 1) != 1) {
+	w.b[0].buf = malloc(MINI_CORE_BATCH);
+	w.b[0].mc = malloc(MINI_CORE_PIECES * sizeof(*w.b[0].mc));
+	if (!w.b[0].buf || !w.b[0].mc)
+		goto out;
+
+	/* with these, target memory is not read here */
+	if (di->cfg->io_uring && !di->fat && !di->stream)
+		mini_uring_open(di, &w);
+
+	/* set core size, the holes stay sparse */
+	if (ftruncate(di->core_fd, di->core_file_size) != 0) {
 		info("failed to set core size: %" PRIu64 " bytes",
 		     di->core_file_size);
 	}
 
+	b = &w.b[w.cur];
 	for (cur = di->core_file; cur; cur = cur->next) {
-		if (lseek64(cur->mem_fd, cur->mem_start, SEEK_SET) == -1) {
-			info("lseek di->mem_fd failed at 0x%lx",
-			     cur->mem_start);
-			goto out;
-		}
+		for (done = 0; done < cur->end - cur->start; done += chunk) {
+			if (b->len == MINI_CORE_BATCH ||
+			    b->n == MINI_CORE_PIECES) {
+				if (mini_flush(di, &w) != 0)
+					goto out;
+				b = &w.b[w.cur];
+			}
 
-		if (lseek64(di->core_fd, cur->start, SEEK_SET) == -1) {
-			info("lseek di->core_fd failed at 0x%lx", cur->start);
-			goto out;
+			chunk = cur->end - cur->start - done;
+			if (chunk > MINI_CORE_BATCH - b->len)
+				chunk = MINI_CORE_BATCH - b->len;
+
+			b->mc[b->n].src_fd = cur->mem_fd;
+			b->mc[b->n].src_off = cur->mem_start + done;
+			b->mc[b->n].dst_off = cur->start + done;
+			b->mc[b->n].len = chunk;
+			b->mc[b->n].buf_off = b->len;
+			b->len += chunk;
+			b->n++;
 		}
+	}
+
+	if (mini_flush(di, &w) != 0)
+		goto out;
 
-		if (copy_data(cur->mem_fd, di->core_fd, -1,
-			      cur->end - cur->start, buf) < 0) {
+	if (w.u) {
+		mini_drain(di, &w);
+		if (w.err)
 			goto out;
-		}
 	}
 
 	info("core path: %s", di->core_path);
 out:
-	free(buf);
+	if (w.u) {
+		mini_drain(di, &w);
+		uring_close(w.u);
+	}
+	for (i = 0; i < MINI_CORE_URING_BATCHES; i++) {
+		free(w.b[i].mc);
+		free(w.b[i].buf);
+	}
+}
+
+/*
+ * The dump list is kept both as a sorted linked list (used for ordered
+ * iteration) and as a treap keyed by the core offset of each entry (used
+ * to find the insertion point in O(log n)). The core offsets of the
+ * entries are unique.
+ */
+struct core_data_node {
+	/* must be first, the list only knows about this part */
+	struct core_data cd;
+
+	struct core_data_node *left;
+	struct core_data_node *right;
+	unsigned int prio;
+};
+
+static unsigned int core_tree_prio(void)
+{
+	static __thread unsigned int seed = 2463534242U;
+
+	/* xorshift32, only used to balance the treap */
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return seed;
+}
+
+static struct core_data_node *core_tree_insert(struct core_data_node *root,
+					       struct core_data_node *n)
+{
+	struct core_data_node *tmp;
+
+	if (!root)
+		return n;
+
+	if (n->cd.start < root->cd.start) {
+		root->left = core_tree_insert(root->left, n);
+		if (root->left->prio > root->prio) {
+			/* rotate right */
+			tmp = root->left;
+			root->left = tmp->right;
+			tmp->right = root;
+			root = tmp;
+		}
+	} else {
+		root->right = core_tree_insert(root->right, n);
+		if (root->right->prio > root->prio) {
+			/* rotate left */
+			tmp = root->right;
+			root->right = tmp->left;
+			tmp->left = root;
+			root = tmp;
+		}
+	}
+
+	return root;
+}
+
+static struct core_data_node *core_tree_join(struct core_data_node *l,
+					     struct core_data_node *r)
+{
+	if (!l)
+		return r;
+	if (!r)
+		return l;
+
+	if (l->prio > r->prio) {
+		l->right = core_tree_join(l->right, r);
+		return l;
+	}
+
+	r->left = core_tree_join(l, r->left);
+	return r;
+}
+
+static struct core_data_node *core_tree_remove(struct core_data_node *root,
+					       off64_t start)
+{
+	if (!root)
+		return NULL;
+
+	if (start < root->cd.start)
+		root->left = core_tree_remove(root->left, start);
+	else if (start > root->cd.start)
+		root->right = core_tree_remove(root->right, start);
+	else
+		root = core_tree_join(root->left, root->right);
+
+	return root;
+}
+
+/* find the last entry starting at or before start */
+static struct core_data_node *core_tree_floor(struct core_data_node *root,
+					      off64_t start)
+{
+	struct core_data_node *found = NULL;
+
+	while (root) {
+		if (root->cd.start <= start) {
+			found = root;
+			root = root->right;
+		} else {
+			root = root->left;
+		}
+	}
+
+	return found;
+}
+
+/* check if cur continues prev in the source file */
+static int core_data_adjacent(struct core_data *prev, struct core_data *cur)
+{
+	return (prev->mem_fd == cur->mem_fd &&
+		prev->mem_start + (prev->end - prev->start) == cur->mem_start);
 }
 
 int add_core_data(struct dump_info *di, off64_t dest_offset, size_t len,
 		  int src_fd, off64_t src_offset)
 {
-	struct core_data *prev = NULL;
+	struct core_data_node *prev;
+	struct core_data_node *tmp;
+	struct core_data new_cd;
 	off64_t start = dest_offset;
 	struct core_data *cur;
-	struct core_data *tmp;
-	int done = 0;
+	struct core_data *next;
 	off64_t end;
 
 	end = start + len;
 
-	if (di->cfg->prog_config.core_in_tar &&
-	    di->cfg->prog_config.core_compressor &&
-	    (start > USTAR_MAXVAL || end > USTAR_MAXVAL)) {
-		info("core data too large for ustar format "
-		     "(0x%" PRIx64 "-0x%" PRIx64 "), dropping",
-		     start, end);
-		return EFBIG;
-	}
-
-	for (cur = di->core_file; cur && !done; cur = cur->next) {
-		if (end < cur->start) {
-			/* insert new block */
-			tmp = calloc(1, sizeof(*tmp));
-			if (!tmp)
-				return ENOMEM;
-
-			tmp->start = start;
-			tmp->end = end;
-			tmp->mem_start = src_offset;
-			tmp->mem_fd = src_fd;
-			tmp->next = cur;
-
-			if (prev)
-				prev->next = tmp;
-			else
-				di->core_file = tmp;
-			done = 1;
+	memset(&new_cd, 0, sizeof(new_cd));
+	new_cd.start = start;
+	new_cd.end = end;
+	new_cd.mem_start = src_offset;
+	new_cd.mem_fd = src_fd;
+
+	prev = core_tree_floor(di->core_tree, start);
+
+	if (prev && (start < prev->cd.end ||
+		     (start == prev->cd.end &&
+		      core_data_adjacent(&prev->cd, &new_cd)))) {
+		/* overlapping or adjacent block, expand existing block */
+		cur = &prev->cd;
+		if (end > cur->end)
+			cur->end = end;
+
+	} else if (prev && prev->cd.start == start) {
+		/* replace empty block */
+		prev->cd.end = end;
+		prev->cd.mem_start = src_offset;
+		prev->cd.mem_fd = src_fd;
+		cur = &prev->cd;
 
-		} else if (end == cur->start) {
-			if ((src_offset + len) == cur->mem_start &&
-			    src_fd == cur->mem_fd) {
-				/* adjacent block, expand existing block */
-				cur->start = start;
-				cur->mem_start = src_offset;
-			} else {
-				/* non-adjacent block, insert new block */
-				tmp = calloc(1, sizeof(*tmp));
-				if (!tmp)
-					return ENOMEM;
-
-				tmp->start = start;
-				tmp->end = end;
-				tmp->mem_start = src_offset;
-				tmp->mem_fd = src_fd;
-				tmp->next = cur;
-
-				if (prev)
-					prev->next = tmp;
-				else
-					di->core_file = tmp;
-			}
-			done = 1;
+	} else {
+		/* insert new block */
+		tmp = calloc(1, sizeof(*tmp));
+		if (!tmp)
+			return ENOMEM;
 
-		} else if (start < cur->end) {
-			/* overlapping block, expand existing block */
-			if (start < cur->start) {
-				cur->start = start;
-				cur->mem_start = src_offset;
-			}
-			if (end > cur->end)
-				cur->end = end;
-			done = 1;
+		tmp->cd = new_cd;
+		tmp->prio = core_tree_prio();
 
-		} else if (start == cur->end) {
-			if (src_offset == (cur->mem_start + len)) {
-				/* adjacent block, expand existing block */
-				cur->end = end;
-				done = 1;
-			}
+		if (prev) {
+			tmp->cd.next = prev->cd.next;
+			prev->cd.next = &tmp->cd;
+		} else {
+			tmp->cd.next = di->core_file;
+			di->core_file = &tmp->cd;
 		}
 
-		while (cur->next) {
-			if (cur->next->start < cur->end) {
-				/* consolidate overlapping block */
-				tmp = cur->next;
-				if (tmp->end > cur->end)
-					cur->end = tmp->end;
-				cur->next = tmp->next;
-				free(tmp);
-				continue;
+		di->core_tree = core_tree_insert(di->core_tree, tmp);
+		cur = &tmp->cd;
+	}
 
-			} else if (cur->next->start == cur->end) {
-				if (((cur->mem_start + (cur->end - cur->start))
-				     == cur->next->mem_start) &&
-				    (cur->mem_fd == cur->next->mem_fd)) {
-					/* consolidate adjacent block */
-					tmp = cur->next;
-					cur->end = tmp->end;
-					cur->next = tmp->next;
-					free(tmp);
-					continue;
-				}
-			}
+	/* consolidate following overlapping or adjacent blocks */
+	while (cur->next) {
+		next = cur->next;
 
+		if (next->start > cur->end)
+			break;
+		if (next->start == cur->end && !core_data_adjacent(cur, next))
 			break;
-		}
-
-		if (done)
-			return 0;
-
-		prev = cur;
-	}
-
-	tmp = calloc(1, sizeof(*tmp));
-	if (!tmp)
-		return ENOMEM;
 
-	tmp->start = start;
-	tmp->end = end;
-	tmp->mem_start = src_offset;
-	tmp->mem_fd = src_fd;
+		if (next->end > cur->end)
+			cur->end = next->end;
+		cur->next = next->next;
 
-	if (prev) {
-		tmp->next = prev->next;
-		prev->next = tmp;
-	} else {
-		tmp->next = di->core_file;
-		di->core_file = tmp;
+		di->core_tree = core_tree_remove(di->core_tree, next->start);
+		free(next);
 	}
 
 	return 0;
 }
 
 /*
- * In case the core file is packed into a tar, make sure the core file
- * size does not exceed the value limits of the ustar format.
+ * Copy the source core to the header until it is @end bytes long.
  */
-static void check_core_size(struct dump_info *di)
+static int fill_src_core(struct dump_info *di, int src, off64_t *pos,
+			 off64_t end, char *buf)
 {
-	if (!di->cfg->prog_config.core_in_tar)
-		return;
-	if (!di->cfg->prog_config.core_compressor)
-		return;
-	if (di->core_file_size <= USTAR_MAXVAL)
-		return;
+	if (*pos >= end)
+		return 0;
+
+	/* position in all cores is already correct, now copy */
+	if (copy_data(src, di->elf_fd, di->fatcore_fd, end - *pos, buf) < 0)
+		return -1;
 
-	info("core is too large for ustar format (%" PRIu64 " bytes), "
-	     "truncating to %" PRIu64 " bytes",
-	     di->core_file_size, USTAR_MAXVAL);
+	*pos = end;
 
-	di->core_file_size = USTAR_MAXVAL;
+	return 0;
 }
 
 /*
  * Reads the ELF header from the large core file.
  * This header is dumped to the core.
+ *
+ * The source core is a pipe, so it is read exactly as far as needed:
+ * first the ELF header, then the program headers it points to and then
+ * the rest up to the first vma.
  */
 static int init_src_core(struct dump_info *di, int src)
 {
-	size_t last_phnum = 0;
-	int tries = 0;
+	unsigned char ident[EI_NIDENT];
+	size_t phentsize;
+	Elf64_Ehdr ehdr64;
+	Elf32_Ehdr ehdr32;
+	GElf_Phdr phdr;
+	off64_t pos = 0;
 	int ret = -1;
+	off64_t phoff;
 	size_t phnum;
-	size_t len;
 	char *buf;
-	long pos;
 
 	buf = malloc(PAGESZ);
 	if (!buf)
 		return -1;
 
-	/*
-	 * Procedure:
-	 * 1. read 2 pages from source core and write to core
-	 * 2. try to elf-parse core
-	 * 3. if unable to parse, read 2 more pages and try again
-	 * 4. try up to 10 times (20 pages)
-	 */
-again:
-	/* copy 2 pages */
-	if (copy_data(src, di->elf_fd, di->fatcore_fd, PAGESZ * 2, buf) < 0)
+	/* the 64-bit ELF header is the larger one */
+	if (fill_src_core(di, src, &pos, sizeof(ehdr64), buf) != 0)
 		goto out;
 
-	/* remember our position */
-	pos = lseek64(di->elf_fd, 0, SEEK_CUR);
-	if (pos == -1)
+	if (pread(di->elf_fd, ident, sizeof(ident), 0) != sizeof(ident))
 		goto out;
 
-	/* try to elf-parse the core to read vma info */
-	ret = parse_vma_info(di, &phnum);
+	if (memcmp(ident, ELFMAG, SELFMAG) != 0) {
+		info("elf error: invalid magic");
+		goto out;
+	}
 
-	/* restore our position */
-	if (lseek64(di->elf_fd, pos, SEEK_SET) == -1)
+	if (ident[EI_DATA] != ELFDATA_NATIVE) {
+		info("elf error: foreign byte order");
 		goto out;
+	}
 
-	if (ret != 0) {
-		/* elf-parse failed */
+	di->elfclass = ident[EI_CLASS];
+	if (di->elfclass == ELFCLASS64) {
+		if (pread(di->elf_fd, &ehdr64, sizeof(ehdr64), 0) !=
+		    sizeof(ehdr64)) {
+			goto out;
+		}
+		phoff = ehdr64.e_phoff;
+		phentsize = ehdr64.e_phentsize;
+		phnum = ehdr64.e_phnum;
+		if (phentsize < sizeof(Elf64_Phdr))
+			phentsize = 0;
+	} else if (di->elfclass == ELFCLASS32) {
+		if (pread(di->elf_fd, &ehdr32, sizeof(ehdr32), 0) !=
+		    sizeof(ehdr32)) {
+			goto out;
+		}
+		phoff = ehdr32.e_phoff;
+		phentsize = ehdr32.e_phentsize;
+		phnum = ehdr32.e_phnum;
+		if (phentsize < sizeof(Elf32_Phdr))
+			phentsize = 0;
+	} else {
+		info("elf error: invalid class %d", di->elfclass);
+		goto out;
+	}
+
+	if (phoff == 0 || phnum == 0 || phentsize == 0 ||
+	    phentsize > (size_t)PAGESZ) {
+		info("elf error: no program headers");
+		goto out;
+	}
 
-		tries++;
+	if (phnum == PN_XNUM) {
+		/*
+		 * The real number is in the section header, which the
+		 * kernel writes at the end of the core. But the notes,
+		 * which are first, start right after the program headers.
+		 */
+		if (fill_src_core(di, src, &pos, phoff + phentsize,
+				  buf) != 0) {
+			goto out;
+		}
 
-		if (phnum > last_phnum) {
-			/* new headers found, keep trying */
-			last_phnum = phnum;
-			goto again;
-		} else if (tries < 10) {
-			/*
-			 * even if no new headers are found,
-			 * retry at least 10 times
-			 */
-			goto again;
+		if (pread(di->elf_fd, buf, phentsize, phoff) !=
+		    (ssize_t)phentsize) {
+			goto out;
+		}
+		get_src_phdr(di, buf, 0, phentsize, &phdr);
+
+		if (phdr.p_type != PT_NOTE || phdr.p_offset <= phoff) {
+			info("elf error: unable to count program headers");
+			goto out;
 		}
+		phnum = (phdr.p_offset - phoff) / phentsize;
+	}
 
+	/* copy all program headers */
+	if (fill_src_core(di, src, &pos, phoff + (phnum * phentsize),
+			  buf) != 0) {
 		goto out;
 	}
 
-	if (di->vma_start > (unsigned long)pos) {
-		/* copy the rest of core up to the first vma */
-		len = di->vma_start - pos;
+	if (parse_vma_info(di, phoff, phentsize, phnum, buf) != 0)
+		goto out;
 
-		/* position in all cores is already correct, now copy */
-		if (copy_data(src, di->elf_fd, di->fatcore_fd, len, buf) < 0)
-			goto out;
+	/* copy the rest of core up to the first vma */
+	if (fill_src_core(di, src, &pos, di->vma_start, buf) != 0)
+		goto out;
+
+	/* map the headers for parsing and for adding the dump list */
+	di->elf_hdr = mmap(NULL, pos, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   di->elf_fd, 0);
+	if (di->elf_hdr == MAP_FAILED) {
+		info("unable to map core headers: %s", strerror(errno));
+		di->elf_hdr = NULL;
+		goto out;
 	}
+	di->elf_hdr_size = pos;
 
 	add_core_data(di, 0, di->vma_start, di->elf_fd, 0);
 
 	/* make the core big enough to fit all vma areas */
 	di->core_file_size = di->vma_end;
-	check_core_size(di);
 
 	/* add empty core data to mark the size of the core file */
 	add_core_data(di, di->core_file_size, 0, di->elf_fd, 0);
+
+	ret = 0;
 out:
 	free(buf);
 	return ret;
@@ -1773,27 +3344,205 @@ static void log_vmas(struct dump_info *di)
 	fprintf(di->info_file, "\n");
 }
 
+/* the hash function used by .gnu.hash */
+static uint32_t gnu_hash_str(const char *name)
+{
+	const unsigned char *p = (const unsigned char *)name;
+	uint32_t h = 5381;
+
+	while (*p)
+		h = (h << 5) + h + *p++;
+
+	return h;
+}
+
+static const char *sym_name(struct sym_data *sd, GElf_Sym *s)
+{
+	return elf_strptr(sd->elf, sd->shdr.sh_link, s->st_name);
+}
+
+/*
+ * Check if symbol i is a defined symbol called symname.
+ */
+static int sym_match(struct sym_data *sd, uint32_t i, const char *symname,
+		     GElf_Sym *sym)
+{
+	const char *name;
+
+	if (i >= (uint32_t)sd->count)
+		return 0;
+
+	if (!gelf_getsym(sd->data, i, sym))
+		return 0;
+
+	if (sym->st_shndx == SHN_UNDEF)
+		return 0;
+
+	name = sym_name(sd, sym);
+	if (!name)
+		return 0;
+
+	return (strcmp(name, symname) == 0);
+}
+
+static int gnu_hash_lookup(struct sym_data *sd, const char *symname,
+			   uint32_t h, GElf_Sym *sym)
+{
+	struct gnu_hash *gh = sd->gnu_hash;
+	unsigned int bits;
+	uint64_t word;
+	uint32_t h2;
+	uint32_t i;
+
+	/* the bloom filter rejects most misses */
+	if (sd->elfclass == ELFCLASS64) {
+		bits = 64;
+		word = ((const uint64_t *)gh->bloom)[(h / bits) %
+						     gh->bloom_size];
+	} else {
+		bits = 32;
+		word = ((const uint32_t *)gh->bloom)[(h / bits) %
+						     gh->bloom_size];
+	}
+	if (!((word >> (h % bits)) & 1) ||
+	    !((word >> ((h >> gh->bloom_shift) % bits)) & 1)) {
+		return -1;
+	}
+
+	i = gh->buckets[h % gh->nbuckets];
+	if (i < gh->symoffset)
+		return -1;
+
+	for (; i - gh->symoffset < gh->nchain; i++) {
+		h2 = gh->chain[i - gh->symoffset];
+
+		if ((h | 1) == (h2 | 1) && sym_match(sd, i, symname, sym))
+			return 0;
+
+		/* the last entry of a chain has the lowest bit set */
+		if (h2 & 1)
+			break;
+	}
+
+	return -1;
+}
+
+/*
+ * Build a hash index of all defined symbols. Each chain lists the
+ * symbols in table order, so the first of multiple symbols with the
+ * same name is found.
+ */
+static int build_sym_index(struct sym_data *sd)
+{
+	GElf_Sym sym;
+	const char *name;
+	uint32_t nbuckets;
+	uint32_t b;
+	int i;
+
+	nbuckets = 1;
+	while (nbuckets < (uint32_t)sd->count / 2)
+		nbuckets <<= 1;
+
+	sd->buckets = calloc(nbuckets, sizeof(*sd->buckets));
+	sd->chain = calloc(sd->count, sizeof(*sd->chain));
+	sd->hashes = calloc(sd->count, sizeof(*sd->hashes));
+	if (!sd->buckets || !sd->chain || !sd->hashes) {
+		free(sd->buckets);
+		free(sd->chain);
+		free(sd->hashes);
+		sd->buckets = NULL;
+		sd->chain = NULL;
+		sd->hashes = NULL;
+		return -1;
+	}
+	sd->nbuckets = nbuckets;
+
+	/* buckets and chains hold symbol index + 1, 0 ends a chain */
+	for (i = sd->count - 1; i >= 0; i--) {
+		if (!gelf_getsym(sd->data, i, &sym))
+			continue;
+		if (sym.st_shndx == SHN_UNDEF)
+			continue;
+
+		name = sym_name(sd, &sym);
+		if (!name || name[0] == 0)
+			continue;
+
+		sd->hashes[i] = gnu_hash_str(name);
+		b = sd->hashes[i] & (nbuckets - 1);
+		sd->chain[i] = sd->buckets[b];
+		sd->buckets[b] = i + 1;
+	}
+
+	return 0;
+}
+
+static int sym_index_lookup(struct sym_data *sd, const char *symname,
+			    uint32_t h, GElf_Sym *sym)
+{
+	uint32_t i;
+
+	for (i = sd->buckets[h & (sd->nbuckets - 1)]; i; i = sd->chain[i - 1]) {
+		if (sd->hashes[i - 1] != h)
+			continue;
+
+		if (sym_match(sd, i - 1, symname, sym))
+			return 0;
+	}
+
+	return -1;
+}
+
+static int sym_linear_lookup(struct sym_data *sd, const char *symname,
+			     GElf_Sym *sym)
+{
+	int i;
+
+	for (i = 0; i < sd->count; i++) {
+		if (sym_match(sd, i, symname, sym))
+			return 0;
+	}
+
+	return -1;
+}
+
 static int sym_address(struct dump_info *di, const char *symname,
 		       unsigned long *addr)
 {
 	struct sym_data *sd;
-	int i;
+	uint64_t value;
+	GElf_Sym sym;
+	uint32_t h2;
+	uint32_t h;
+	int ret;
+
+	/* h is the .gnu.hash of symname */
+	sym_cache_hash(symname, &h, &h2);
 
 	for (sd = di->sym_data_list; sd; sd = sd->next) {
-		for (i = 0; i < sd->count; i++) {
-			GElf_Sym sym;
-			GElf_Sym *s;
+		if (sd->cache) {
+			if (sym_cache_lookup(sd->cache, h, h2, &value) == 0) {
+				*addr = sd->start + value;
+				return 0;
+			}
+			continue;
+		}
 
-			s = gelf_getsym(sd->data, i, &sym);
-			if (!s)
-				continue;
+		if (sd->gnu_hash) {
+			ret = gnu_hash_lookup(sd, symname, h, &sym);
+		} else {
+			if (!sd->buckets)
+				build_sym_index(sd);
 
-			if (strcmp(elf_strptr(sd->elf, sd->shdr.sh_link,
-					      s->st_name), symname) != 0) {
-				continue;
-			}
+			if (sd->buckets)
+				ret = sym_index_lookup(sd, symname, h, &sym);
+			else
+				ret = sym_linear_lookup(sd, symname, &sym);
+		}
 
-			*addr = sd->start + s->st_value;
+		if (ret == 0) {
+			*addr = sd->start + sym.st_value;
 			return 0;
 		}
 	}
@@ -1801,6 +3550,72 @@ static int sym_address(struct dump_info *di, const char *symname,
 	return -1;
 }
 
+/*
+ * Find the .gnu.hash table belonging to the symbol table sym_scn.
+ */
+static struct gnu_hash *alloc_gnu_hash(Elf *elf, Elf_Scn *sym_scn,
+				       int count)
+{
+	size_t ndx = elf_ndxscn(sym_scn);
+	const uint32_t *words;
+	struct gnu_hash *gh;
+	Elf_Scn *scn = NULL;
+	size_t bloom_bytes;
+	Elf_Data *data;
+	GElf_Shdr shdr;
+	size_t need;
+
+	while (1) {
+		scn = elf_nextscn(elf, scn);
+		if (!scn)
+			return NULL;
+
+		if (!gelf_getshdr(scn, &shdr))
+			continue;
+
+		if (shdr.sh_type == SHT_GNU_HASH && shdr.sh_link == ndx)
+			break;
+	}
+
+	/* raw data: the table is in native byte order */
+	data = elf_rawdata(scn, NULL);
+	if (!data || data->d_size < 4 * sizeof(uint32_t))
+		return NULL;
+
+	gh = calloc(1, sizeof(*gh));
+	if (!gh)
+		return NULL;
+
+	words = data->d_buf;
+	gh->nbuckets = words[0];
+	gh->symoffset = words[1];
+	gh->bloom_size = words[2];
+	gh->bloom_shift = words[3];
+
+	if (gelf_getclass(elf) == ELFCLASS64)
+		bloom_bytes = gh->bloom_size * sizeof(uint64_t);
+	else
+		bloom_bytes = gh->bloom_size * sizeof(uint32_t);
+
+	need = (4 * sizeof(uint32_t)) + bloom_bytes +
+	       (gh->nbuckets * sizeof(uint32_t));
+
+	/* sanity checks */
+	if (gh->nbuckets == 0 || gh->bloom_size == 0 ||
+	    data->d_size < need || gh->symoffset > (uint32_t)count) {
+		free(gh);
+		return NULL;
+	}
+
+	gh->bloom = &words[4];
+	gh->buckets = (const uint32_t *)((const char *)gh->bloom +
+					 bloom_bytes);
+	gh->chain = gh->buckets + gh->nbuckets;
+	gh->nchain = (data->d_size - need) / sizeof(uint32_t);
+
+	return gh;
+}
+
 static struct sym_data *alloc_sym_data(const char *file, unsigned long start,
 				       GElf_Word type)
 {
@@ -1839,15 +3654,88 @@ static struct sym_data *alloc_sym_data(const char *file, unsigned long start,
 
 	sd->data = elf_getdata(scn, NULL);
 	sd->count = sd->shdr.sh_size / sd->shdr.sh_entsize;
+	sd->elfclass = gelf_getclass(sd->elf);
+
+	/* only dynamic symbols are covered by .gnu.hash */
+	if (type == SHT_DYNSYM)
+		sd->gnu_hash = alloc_gnu_hash(sd->elf, scn, sd->count);
 
 	return sd;
 }
 
+/*
+ * Write the on-disk symbol index for the symbol tables starting at sd.
+ */
+static void write_sym_cache(struct dump_info *di, struct sym_data *sd,
+			    const unsigned char *id, size_t id_len)
+{
+	struct sym_cache_entry *entries;
+	struct sym_data *cur;
+	const char *name;
+	uint32_t count = 0;
+	GElf_Sym sym;
+	size_t n = 0;
+	int i;
+
+	for (cur = sd; cur; cur = cur->next)
+		n += cur->count;
+
+	entries = malloc((n ? n : 1) * sizeof(*entries));
+	if (!entries)
+		return;
+
+	/* in lookup order: all of .symtab before .dynsym */
+	for (cur = sd; cur; cur = cur->next) {
+		for (i = 0; i < cur->count; i++) {
+			if (!gelf_getsym(cur->data, i, &sym))
+				continue;
+			if (sym.st_shndx == SHN_UNDEF)
+				continue;
+
+			name = sym_name(cur, &sym);
+			if (!name || name[0] == 0)
+				continue;
+
+			sym_cache_hash(name, &entries[count].hash,
+				       &entries[count].hash2);
+			entries[count].value = sym.st_value;
+			count++;
+		}
+	}
+
+	if (sym_cache_write(di->cfg->sym_cache_dir, id, id_len,
+			    entries, count) != 0) {
+		info("unable to write symbol cache to %s",
+		     di->cfg->sym_cache_dir);
+	}
+
+	free(entries);
+}
+
+static void add_sym_data(struct dump_info *di, struct sym_data *sd)
+{
+	struct sym_data *cur;
+
+	if (!di->sym_data_list) {
+		di->sym_data_list = sd;
+	} else {
+		/* add new node to end of list */
+		for (cur = di->sym_data_list; cur->next; cur = cur->next) {
+			/* NOP */ ;
+		}
+		cur->next = sd;
+	}
+}
+
 static int store_sym_data(struct dump_info *di, const char *lib,
 			  unsigned long start)
 {
+	unsigned char id[SYM_CACHE_MAX_ID];
+	struct sym_data *first = NULL;
 	struct sym_data *cur;
 	struct sym_data *sd;
+	struct sym_cache *sc;
+	size_t id_len = 0;
 	GElf_Word type;
 	int err = -1;
 	int i;
@@ -1858,6 +3746,24 @@ static int store_sym_data(struct dump_info *di, const char *lib,
 			return 0;
 	}
 
+	/* try the on-disk symbol index for this build-id */
+	if (di->cfg->sym_cache_dir &&
+	    sym_cache_build_id(lib, id, &id_len) == 0) {
+		sc = sym_cache_open(di->cfg->sym_cache_dir, id, id_len);
+		if (sc) {
+			sd = calloc(1, sizeof(*sd));
+			if (!sd) {
+				sym_cache_close(sc);
+				return -1;
+			}
+			sd->start = start;
+			sd->fd = -1;
+			sd->cache = sc;
+			add_sym_data(di, sd);
+			return 0;
+		}
+	}
+
 	/* allocate new sym_data node */
 	for (i = 0; i < 2; i++) {
 		if (i == 0)
@@ -1869,36 +3775,101 @@ static int store_sym_data(struct dump_info *di, const char *lib,
 		if (!sd)
 			continue;
 
-		if (!di->sym_data_list) {
-			di->sym_data_list = sd;
+		add_sym_data(di, sd);
+		if (!first)
+			first = sd;
+
+		/* report success if data was added */
+		err = 0;
+	}
+
+	if (first && id_len > 0)
+		write_sym_cache(di, first, id, id_len);
+
+	return err;
+}
+
+static void close_sym(struct dump_info *di)
+{
+	struct sym_data *sd;
+
+	while (di->sym_data_list) {
+		sd = di->sym_data_list;
+		di->sym_data_list = sd->next;
+
+		if (sd->cache) {
+			sym_cache_close(sd->cache);
 		} else {
-			/* add new node to end of list */
-			for (cur = di->sym_data_list; cur->next;
-			     cur = cur->next) {
-				/* NOP */ ;
-			}
-			cur->next = sd;
+			elf_end(sd->elf);
+			close(sd->fd);
 		}
+		free(sd->gnu_hash);
+		free(sd->buckets);
+		free(sd->chain);
+		free(sd->hashes);
+		free(sd);
+	}
+}
+
+static int page_cache_init(struct dump_info *di)
+{
+	struct page_cache *pc = &di->page_cache;
+	int i;
+
+	if (pc->addr)
+		return 0;
 
-		/* report success if data was added */
-		err = 0;
+	pc->addr = malloc(sizeof(*pc->addr) * PAGE_CACHE_SLOTS);
+	pc->data = malloc(PAGESZ * PAGE_CACHE_SLOTS);
+	if (!pc->addr || !pc->data) {
+		free(pc->addr);
+		free(pc->data);
+		pc->addr = NULL;
+		pc->data = NULL;
+		return -1;
 	}
 
-	return err;
+	for (i = 0; i < PAGE_CACHE_SLOTS; i++)
+		pc->addr[i] = PAGE_CACHE_EMPTY;
+
+	return 0;
 }
 
-static void close_sym(struct dump_info *di)
+static void page_cache_free(struct dump_info *di)
 {
-	struct sym_data *sd;
+	struct page_cache *pc = &di->page_cache;
 
-	while (di->sym_data_list) {
-		sd = di->sym_data_list;
-		di->sym_data_list = sd->next;
+	free(pc->addr);
+	free(pc->data);
+	pc->addr = NULL;
+	pc->data = NULL;
+}
 
-		elf_end(sd->elf);
-		close(sd->fd);
-		free(sd);
+static void free_deferred_files(struct dump_info *di)
+{
+	struct deferred_file *df;
+
+	while (di->deferred) {
+		df = di->deferred;
+		di->deferred = df->next;
+		free(df->ident);
+		free(df->data);
+		free(df);
+	}
+}
+
+static void free_deferred_proc(struct dump_info *di)
+{
+	struct deferred_proc *dp;
+
+	while (di->deferred_proc) {
+		dp = di->deferred_proc;
+		di->deferred_proc = dp->next;
+		free(dp->path);
+		free(dp->data);
+		free(dp);
 	}
+	di->deferred_proc_tail = &di->deferred_proc;
 }
 
 static void cleanup_di(struct dump_info *di)
@@ -1907,6 +3878,7 @@ static void cleanup_di(struct dump_info *di)
 	struct core_vma *vma;
 
 	close_sym(di);
+	page_cache_free(di);
 
 	if (di->core_fd >= 0) {
 		close(di->core_fd);
@@ -1916,6 +3888,10 @@ static void cleanup_di(struct dump_info *di)
 		close(di->fatcore_fd);
 		di->fatcore_fd = -1;
 	}
+	if (di->elf_hdr) {
+		munmap(di->elf_hdr, di->elf_hdr_size);
+		di->elf_hdr = NULL;
+	}
 	if (di->elf_fd >= 0) {
 		close(di->elf_fd);
 		di->elf_fd = -1;
@@ -1924,6 +3900,9 @@ static void cleanup_di(struct dump_info *di)
 		close(di->mem_fd);
 		di->mem_fd = -1;
 	}
+	core_stream_free(di);
+	free_deferred_files(di);
+	free_deferred_proc(di);
 	if (di->info_file) {
 		fclose(di->info_file);
 		di->info_file = NULL;
@@ -1954,6 +3933,8 @@ static void cleanup_di(struct dump_info *di)
 		di->core_file = core_data->next;
 		free(core_data);
 	}
+	di->core_tree = NULL;
+	free_vma_index(di);
 	while (di->vma) {
 		vma = di->vma;
 		di->vma = vma->next;
@@ -2022,29 +4003,54 @@ out_err:
 #undef STAT_LINE_MAXSIZE
 }
 
-static struct core_vma *get_next_vma_range(struct dump_info *di,
-					   unsigned long start,
-					   unsigned long end,
-					   struct core_vma *vma)
+/*
+ * Returns the index (in the sorted vma index) of the first vma ending
+ * after addr or di->nvmas if there is none. The last found vma is
+ * remembered since lookups are often for neighbouring addresses.
+ */
+static int get_vma_index(struct dump_info *di, unsigned long addr)
 {
-	/* check for range overlap with vma */
-	for ( ; vma; vma = vma->next) {
-		if (end > vma->start && start < vma->mem_end)
-			break;
+	struct core_vma *vma;
+	int first;
+	int last;
+	int mid;
+
+	if (di->vma_last < di->nvmas) {
+		vma = di->vma_index[di->vma_last];
+		if (addr >= vma->start && addr < vma->mem_end)
+			return di->vma_last;
 	}
 
-	return vma;
+	/* binary search, vmas do not overlap */
+	first = 0;
+	last = di->nvmas;
+	while (first < last) {
+		mid = first + (last - first) / 2;
+		if (di->vma_index[mid]->mem_end > addr)
+			last = mid;
+		else
+			first = mid + 1;
+	}
+
+	if (first < di->nvmas)
+		di->vma_last = first;
+
+	return first;
 }
 
 static struct core_vma *get_vma_pos(struct dump_info *di, unsigned long addr)
 {
 	struct core_vma *vma;
+	int i;
 
-	for (vma = di->vma; vma; vma = vma->next) {
-		/* check for address within vma */
-		if (addr >= vma->start && addr < vma->mem_end)
-			break;
-	}
+	i = get_vma_index(di, addr);
+	if (i >= di->nvmas)
+		return NULL;
+
+	/* check for address within vma */
+	vma = di->vma_index[i];
+	if (addr < vma->start)
+		return NULL;
 
 	return vma;
 }
@@ -2065,11 +4071,13 @@ static int dump_vma(struct dump_info *di, unsigned long start, size_t len,
 	int err = 0;
 	va_list ap;
 	int ret;
+	int i;
 
 	end = start + len;
 
-	tmp = get_next_vma_range(di, start, end, di->vma);
-	if (!tmp) {
+	/* find the first vma overlapping the range */
+	i = get_vma_index(di, start);
+	if (i >= di->nvmas || di->vma_index[i]->start >= end) {
 		info("vma not found start=0x%lx! bad recept or internal bug!",
 		     start);
 		return EINVAL;
@@ -2082,7 +4090,9 @@ static int dump_vma(struct dump_info *di, unsigned long start, size_t len,
 	if (ret == -1)
 		return ENOMEM;
 
-	while (tmp) {
+	for (; i < di->nvmas && di->vma_index[i]->start < end; i++) {
+		tmp = di->vma_index[i];
+
 		dump_start = start;
 		dump_end = end;
 
@@ -2112,8 +4122,6 @@ static int dump_vma(struct dump_info *di, unsigned long start, size_t len,
 			if (err)
 				break;
 		}
-
-		tmp = get_next_vma_range(di, start, end, tmp->next);
 	}
 
 	if (desc)
@@ -2184,7 +4192,7 @@ static int dump_stacks(struct dump_info *di)
 		/* find and set the first task */
 		memset(&type, 0, sizeof(type));
 		type.p_type = PT_NOTE;
-		do_elf_ph_parse(di, &type, note_cb, NULL);
+		do_elf_ph_parse(di, &type, note_cb);
 	}
 
 	if (di->first_pid)
@@ -2247,13 +4255,20 @@ static off64_t get_core_pos(struct dump_info *di, unsigned long addr)
 static int map_is_interesting(struct dump_info *di, const char *name,
 			      size_t len)
 {
+	struct maps_config *maps = &di->cfg->prog_config.maps;
 	unsigned int i;
+	int ret;
 
-	for (i = 0; i < di->cfg->prog_config.maps.nglobs; i++) {
-		if (simple_match(di->cfg->prog_config.maps.name_globs[i],
-				 name) == 0) {
-			return 1;
+	for (i = 0; i < maps->nglobs; i++) {
+		if (maps->name_globs_compiled &&
+		    maps->name_globs_compiled[i]) {
+			ret = glob_match(maps->name_globs_compiled[i], name);
+		} else {
+			/* not compiled (out of memory) */
+			ret = simple_match(maps->name_globs[i], name);
 		}
+		if (ret == 0)
+			return 1;
 	}
 
 	return 0;
@@ -2364,10 +4379,210 @@ static int do_exact_pread(int fd, void *buf, size_t nbytes, off64_t offset)
 	return 0;
 }
 
+/*
+ * Read a set of remote memory areas. The areas are gathered into as few
+ * process_vm_readv() calls as possible. An area that cannot be read that
+ * way (for example because one of its pages faults) is retried with
+ * pread on /proc/PID/mem. Returns the number of leading areas that were
+ * read successfully.
+ */
+static int fetch_remote_vec(struct dump_info *di, struct remote_read *rr,
+			    int n)
+{
+#ifdef HAVE_PROCESS_VM_READV
+	struct iovec local[REMOTE_READ_BATCH];
+	struct iovec remote[REMOTE_READ_BATCH];
+	ssize_t ret;
+	int cnt;
+	int j;
+#endif
+	int i = 0;
+
+	while (i < n) {
+#ifdef HAVE_PROCESS_VM_READV
+		if (!di->no_vm_readv) {
+			cnt = n - i;
+			if (cnt > REMOTE_READ_BATCH)
+				cnt = REMOTE_READ_BATCH;
+
+			for (j = 0; j < cnt; j++) {
+				local[j].iov_base = rr[i + j].dst;
+				local[j].iov_len = rr[i + j].len;
+				remote[j].iov_base = (void *)rr[i + j].addr;
+				remote[j].iov_len = rr[i + j].len;
+			}
+
+			ret = process_vm_readv(di->pid, local, cnt, remote,
+					       cnt, 0);
+			if (ret < 0 && (errno == ENOSYS || errno == EPERM)) {
+				/* not usable for this task, stick to pread */
+				di->no_vm_readv = 1;
+				ret = 0;
+			} else if (ret < 0) {
+				ret = 0;
+			}
+
+			/* skip all areas that were completely read */
+			for (j = 0; j < cnt; j++) {
+				if ((size_t)ret < rr[i].len)
+					break;
+				ret -= rr[i].len;
+				i++;
+			}
+
+			if (j == cnt)
+				continue;
+		}
+#endif
+		/* fall back to pread for the faulting area */
+		if (do_exact_pread(di->mem_fd, rr[i].dst, rr[i].len,
+				   rr[i].addr) != 0) {
+			return i;
+		}
+		i++;
+	}
+
+	return n;
+}
+
+static int page_cache_slot(unsigned long page)
+{
+	return (page / PAGESZ) % PAGE_CACHE_SLOTS;
+}
+
+/*
+ * Copy a remote area out of the page cache.
+ * Fails if any of its pages is not cached.
+ */
+static int page_cache_copy(struct page_cache *pc, struct remote_read *rr)
+{
+	unsigned long addr = rr->addr;
+	size_t len = rr->len;
+	char *dst = rr->dst;
+	unsigned long page;
+	size_t off;
+	size_t sz;
+	int slot;
+
+	if (len > PAGE_CACHE_MAX_READ)
+		return -1;
+
+	while (len) {
+		page = addr & ~(PAGESZ - 1);
+		off = addr - page;
+		sz = PAGESZ - off;
+		if (sz > len)
+			sz = len;
+
+		slot = page_cache_slot(page);
+		if (pc->addr[slot] != page)
+			return -1;
+
+		memcpy(dst, pc->data + (slot * PAGESZ) + off, sz);
+
+		dst += sz;
+		addr += sz;
+		len -= sz;
+	}
+
+	return 0;
+}
+
+/*
+ * Read a set of remote memory areas, serving them from the page cache
+ * where possible. All missing pages are read into the cache with a
+ * single batch. Areas that do not fit in the cache (or whose pages were
+ * not readable) are read directly. Returns the number of leading areas
+ * that were read successfully.
+ */
+static int read_remote_vec(struct dump_info *di, struct remote_read *rr,
+			   int n)
+{
+	struct remote_read pages[PAGE_CACHE_SLOTS];
+	struct page_cache *pc = &di->page_cache;
+	unsigned long page;
+	int npages = 0;
+	int done;
+	int slot;
+	int ret;
+	int i;
+	int j;
+
+	if (page_cache_init(di) != 0)
+		return fetch_remote_vec(di, rr, n);
+
+	/* collect all pages that are not cached yet */
+	for (i = 0; i < n; i++) {
+		if (rr[i].len == 0 || rr[i].len > PAGE_CACHE_MAX_READ)
+			continue;
+
+		for (page = rr[i].addr & ~(PAGESZ - 1);
+		     page < rr[i].addr + rr[i].len; page += PAGESZ) {
+			slot = page_cache_slot(page);
+			if (pc->addr[slot] == page) {
+				pc->hits++;
+				continue;
+			}
+
+			pc->misses++;
+
+			if (npages == PAGE_CACHE_SLOTS)
+				continue;
+
+			pc->addr[slot] = page;
+			pages[npages].addr = page;
+			pages[npages].dst = pc->data + (slot * PAGESZ);
+			pages[npages].len = PAGESZ;
+			npages++;
+		}
+	}
+
+	/* fill the cache, skipping over unreadable pages */
+	for (done = 0; done < npages; done++) {
+		done += fetch_remote_vec(di, &pages[done], npages - done);
+		if (done < npages)
+			pc->addr[page_cache_slot(pages[done].addr)] =
+				PAGE_CACHE_EMPTY;
+	}
+
+	/* serve from cache, reading uncached runs directly */
+	for (i = 0; i < n; ) {
+		if (page_cache_copy(pc, &rr[i]) == 0) {
+			i++;
+			continue;
+		}
+
+		for (j = i + 1; j < n; j++) {
+			if (page_cache_copy(pc, &rr[j]) == 0)
+				break;
+		}
+
+		ret = fetch_remote_vec(di, &rr[i], j - i);
+		if (ret < j - i)
+			return i + ret;
+		i = j;
+	}
+
+	return n;
+}
+
+static void log_page_cache(struct dump_info *di)
+{
+	struct page_cache *pc = &di->page_cache;
+
+	if (!di->info_file)
+		return;
+
+	fprintf(di->info_file, "remote page cache: %lu hits, %lu misses\n",
+		pc->hits, pc->misses);
+}
+
 static int read_remote(struct dump_info *di, unsigned long addr, void *dst,
 		       ssize_t len)
 {
-	if (do_exact_pread(di->mem_fd, dst, len, addr) != 0) {
+	struct remote_read rr = { addr, dst, len };
+
+	if (read_remote_vec(di, &rr, 1) != 1) {
 		info("read_remote failed: len=%d, addr=0x%lx, "
 		     "dest=0x%x, errno=\"%s\"",
 		     len, addr, dst, strerror(errno));
@@ -2377,27 +4592,55 @@ static int read_remote(struct dump_info *di, unsigned long addr, void *dst,
 	return 0;
 }
 
+/*
+ * Read a NUL-terminated string from the target. The string is read in
+ * chunks that never cross a page boundary, so each page is read only
+ * once and a string ending right before an unmapped page can be read.
+ * Strings longer than max_len - 1 characters are truncated.
+ */
 static int alloc_remote_string(struct dump_info *di, unsigned long addr,
-			       char **dst)
+			       size_t max_len, char **dst)
 {
-#define REMOTE_STRING_MAX 4096
-	char *ptr;
+	struct remote_read rr;
+	char *ptr = NULL;
+	size_t size = 0;
+	size_t len = 0;
+	size_t chunk;
+	char *end;
+	char *tmp;
 	int ret;
-	int i;
 
 	*dst = NULL;
 
-	if (addr == 0)
+	if (addr == 0 || max_len < 2)
 		return EINVAL;
 
-	/* TODO: only max string length of 4095 accepted */
+	while (len < max_len - 1) {
+		/* read up to the end of the page */
+		chunk = PAGESZ - ((addr + len) & (PAGESZ - 1));
+		if (chunk > max_len - 1 - len)
+			chunk = max_len - 1 - len;
+
+		if (len + chunk + 1 > size) {
+			size = size * 2;
+			if (size < len + chunk + 1)
+				size = len + chunk + 1;
+			if (size > max_len)
+				size = max_len;
+
+			tmp = realloc(ptr, size);
+			if (!tmp) {
+				free(ptr);
+				return ENOMEM;
+			}
+			ptr = tmp;
+		}
 
-	ptr = malloc(REMOTE_STRING_MAX);
-	if (!ptr)
-		return ENOMEM;
+		rr.addr = addr + len;
+		rr.dst = ptr + len;
+		rr.len = chunk;
 
-	for (i = 1; i < REMOTE_STRING_MAX; i++) {
-		if (do_exact_pread(di->mem_fd, ptr, i, addr) != 0) {
+		if (read_remote_vec(di, &rr, 1) != 1) {
 			ret = errno;
 			info("read_remote failed: addr %#lx: %s", addr,
 			     strerror(errno));
@@ -2407,15 +4650,20 @@ static int alloc_remote_string(struct dump_info *di, unsigned long addr,
 			return ret;
 		}
 
-		if (ptr[i - 1] == 0)
-			break;
+		end = memchr(ptr + len, 0, chunk);
+		if (end) {
+			*dst = ptr;
+			return 0;
+		}
+
+		len += chunk;
 	}
 
-	ptr[i - 1] = 0;
+	/* truncate */
+	ptr[len] = 0;
 	*dst = ptr;
 
 	return 0;
-#undef REMOTE_STRING_MAX
 }
 
 static void *do_setup_data(struct dump_data_elem *elem, void *data)
@@ -2477,7 +4725,7 @@ static int alloc_remote_data_content(struct dump_info *di, unsigned long addr,
 
 	if (dd->ident) {
 		ret = alloc_remote_string(di, (unsigned long)dd->ident,
-					  &dd->ident);
+					  REMOTE_STRING_MAX, &dd->ident);
 		if (ret != 0)
 			return EFAULT;
 
@@ -2493,7 +4741,7 @@ static int alloc_remote_data_content(struct dump_info *di, unsigned long addr,
 
 	if (dd->fmt) {
 		ret = alloc_remote_string(di, (unsigned long)dd->fmt,
-					  &dd->fmt);
+					  REMOTE_STRING_MAX, &dd->fmt);
 		if (ret != 0) {
 			/* clear fields so there is no free() attempt */
 			dd->fmt = NULL;
@@ -2528,36 +4776,66 @@ static int alloc_remote_data_content(struct dump_info *di, unsigned long addr,
 	return 0;
 }
 
-static int dump_data_to_core(struct dump_info *di, struct dump_data_elem *es,
-			     const char *symname)
+/*
+ * Resolve the (possibly indirect) data pointer and length of a dump
+ * data element. Both indirections are read from the target together.
+ */
+static int resolve_dump_data_elem(struct dump_info *di,
+				  struct dump_data_elem *es,
+				  unsigned long *addr, size_t *length)
 {
-	unsigned long addr_ind;
-	unsigned long addr;
-	size_t length;
-	int ret;
+	struct remote_read rr[2];
+	int n = 0;
 
 	/* resolve data pointer */
 	if ((es->flags & MCD_DATA_PTR_INDIRECT)) {
-		addr_ind = (unsigned long)es->data_ptr;
-		ret = read_remote(di, (unsigned long)es->data_ptr,
-				  &addr, sizeof(es->data_ptr));
-		if (ret != 0)
-			return ret;
+		rr[n].addr = (unsigned long)es->data_ptr;
+		rr[n].dst = addr;
+		rr[n].len = sizeof(es->data_ptr);
+		n++;
 	} else {
-		addr_ind = 0;
-		addr = (unsigned long)es->data_ptr;
+		*addr = (unsigned long)es->data_ptr;
 	}
 
 	/* resolve length pointer */
 	if ((es->flags & MCD_LENGTH_INDIRECT)) {
-		ret = read_remote(di, (unsigned long)es->u.length_ptr,
-				  &length, sizeof(es->u.length_ptr));
-		if (ret != 0)
-			return ret;
+		rr[n].addr = (unsigned long)es->u.length_ptr;
+		rr[n].dst = length;
+		rr[n].len = sizeof(es->u.length_ptr);
+		n++;
 	} else {
-		length = es->u.length;
+		*length = es->u.length;
+	}
+
+	if (n == 0)
+		return 0;
+
+	if (read_remote_vec(di, rr, n) != n) {
+		info("read_remote failed: unable to resolve dump data "
+		     "element: %s", strerror(errno));
+		return -1;
 	}
 
+	return 0;
+}
+
+static int dump_data_to_core(struct dump_info *di, struct dump_data_elem *es,
+			     const char *symname)
+{
+	unsigned long addr_ind;
+	unsigned long addr;
+	size_t length;
+	int ret;
+
+	ret = resolve_dump_data_elem(di, es, &addr, &length);
+	if (ret != 0)
+		return ret;
+
+	if ((es->flags & MCD_DATA_PTR_INDIRECT))
+		addr_ind = (unsigned long)es->data_ptr;
+	else
+		addr_ind = 0;
+
 	/* dump indirect data pointer to core */
 	if (addr_ind != 0) {
 		dump_vma(di, addr_ind, sizeof(es->data_ptr), 0,
@@ -2635,27 +4913,14 @@ static int dump_data_file_bin(struct dump_info *di, struct mcd_dump_data *dd,
 	char *buf;
 	int ret;
 
-	/* resolve data pointer */
-	if ((es->flags & MCD_DATA_PTR_INDIRECT)) {
+	ret = resolve_dump_data_elem(di, es, &addr, &length);
+	if (ret != 0)
+		return ret;
+
+	if ((es->flags & MCD_DATA_PTR_INDIRECT))
 		addr_ind = (unsigned long)es->data_ptr;
-		ret = read_remote(di, (unsigned long)es->data_ptr,
-				  &addr, sizeof(es->data_ptr));
-		if (ret != 0)
-			return ret;
-	} else {
+	else
 		addr_ind = 0;
-		addr = (unsigned long)es->data_ptr;
-	}
-
-	/* resolve length pointer */
-	if ((es->flags & MCD_LENGTH_INDIRECT)) {
-		ret = read_remote(di, (unsigned long)es->u.length_ptr,
-				  &length, sizeof(es->u.length_ptr));
-		if (ret != 0)
-			return ret;
-	} else {
-		length = es->u.length;
-	}
 
 	/* allocate buffer for data */
 	buf = malloc(length);
@@ -2700,6 +4965,64 @@ out:
 	return ret;
 }
 
+static int write_data_content(struct dump_info *di, struct mcd_dump_data *dd,
+			      FILE *file)
+{
+	struct remote_data_callbacks cb = {
+		.setup_data = do_setup_data,
+		.cleanup_data = do_cleanup_data,
+		.cbdata = di,
+	};
+
+	if (dd->type == MCD_BIN)
+		return dump_data_file_bin(di, dd, file);
+
+	return dump_data_file_text(dd, file, &cb);
+}
+
+/*
+ * Capture a registered file dump of a live task in memory. It is written
+ * by write_deferred_files() once the task has been resumed.
+ */
+static int defer_data_content_file(struct dump_info *di,
+				   struct mcd_dump_data *dd)
+{
+	struct deferred_file **p;
+	struct deferred_file *df;
+	FILE *file;
+	int ret;
+
+	df = calloc(1, sizeof(*df));
+	if (!df)
+		return ENOMEM;
+
+	df->ident = strdup(dd->ident);
+	if (!df->ident) {
+		free(df);
+		return ENOMEM;
+	}
+	df->bin = (dd->type == MCD_BIN);
+
+	file = open_memstream(&df->data, &df->len);
+	if (!file) {
+		ret = errno;
+		free(df->ident);
+		free(df);
+		return ret;
+	}
+
+	ret = write_data_content(di, dd, file);
+
+	fclose(file);
+
+	/* keep the order, a text file can be appended to several times */
+	for (p = &di->deferred; *p; p = &(*p)->next)
+		;
+	*p = df;
+
+	return ret;
+}
+
 static int dump_data_content_file(struct dump_info *di,
 				  struct mcd_dump_data *dd)
 {
@@ -2709,6 +5032,10 @@ static int dump_data_content_file(struct dump_info *di,
 	int len;
 	int ret;
 
+	/* do not keep a live task stopped for file output */
+	if (di->signum == 0)
+		return defer_data_content_file(di, dd);
+
 	len = strlen(di->dst_dir) + strlen("/dumps/") + 32 +
 	      strlen(dd->ident) + 1;
 	tmp_path = malloc(len);
@@ -2734,16 +5061,7 @@ static int dump_data_content_file(struct dump_info *di,
 	if (!file)
 		goto out;
 
-	if (dd->type == MCD_BIN) {
-		ret = dump_data_file_bin(di, dd, file);
-	} else {
-		struct remote_data_callbacks cb = {
-			.setup_data = do_setup_data,
-			.cleanup_data = do_cleanup_data,
-			.cbdata = di,
-		};
-		ret = dump_data_file_text(dd, file, &cb);
-	}
+	ret = write_data_content(di, dd, file);
 
 	fclose(file);
 
@@ -2757,6 +5075,50 @@ out:
 	return ret;
 }
 
+static void write_deferred_files(struct dump_info *di)
+{
+	struct deferred_file *df;
+	char *tmp_path;
+	FILE *file;
+
+	for (df = di->deferred; df; df = df->next) {
+		/* empty files are not created */
+		if (df->len == 0)
+			continue;
+
+		if (asprintf(&tmp_path, "%s/dumps", di->dst_dir) == -1)
+			break;
+		mkdir(tmp_path, 0700);
+		free(tmp_path);
+
+		if (asprintf(&tmp_path, "%s/dumps/%i", di->dst_dir,
+			     di->pid) == -1) {
+			break;
+		}
+		mkdir(tmp_path, 0700);
+		free(tmp_path);
+
+		if (asprintf(&tmp_path, "%s/dumps/%i/%s", di->dst_dir, di->pid,
+			     df->ident) == -1) {
+			break;
+		}
+
+		file = fopen(tmp_path, df->bin ? "wx" : "a");
+		if (!file) {
+			info("unable to create \'%s\': %s", tmp_path,
+			     strerror(errno));
+			free(tmp_path);
+			continue;
+		}
+		free(tmp_path);
+
+		fwrite(df->data, df->len, 1, file);
+		fclose(file);
+	}
+
+	free_deferred_files(di);
+}
+
 static int dump_data_content(struct dump_info *di, struct mcd_dump_data *dd,
 			     const char *symname)
 {
@@ -2776,23 +5138,34 @@ static int dump_data_content(struct dump_info *di, struct mcd_dump_data *dd,
 static int dyn_dump(struct dump_info *di)
 {
 	struct mcd_dump_data *iter;
+	struct remote_read rr[2];
 	struct mcd_dump_data *dd;
 	unsigned long dd_addr;
-	unsigned long addr;
 	int version;
 	int err = 0;
 	int ret;
 
 	/* get dump data version */
-	ret = sym_address(di, "mcd_dump_data_version", &addr);
+	ret = sym_address(di, "mcd_dump_data_version", &rr[0].addr);
 	if (ret) {
 		info("libminicoredumper: no dump data version found");
 		return ENOKEY;
 	}
+	rr[0].dst = &version;
+	rr[0].len = sizeof(version);
+
+	/* get address of pointer to head of dump data */
+	ret = sym_address(di, "mcd_dump_data_head", &rr[1].addr);
+	if (ret) {
+		info("libminicoredumper: no dump data found");
+		return ENOKEY;
+	}
+	rr[1].dst = &dd_addr;
+	rr[1].len = sizeof(unsigned long);
 
-	/* read in pointer to head of dump data */
-	ret = read_remote(di, addr, &version, sizeof(version));
-	if (ret != 0)
+	/* read in version and pointer to head of dump data */
+	ret = read_remote_vec(di, rr, 2);
+	if (ret < 1)
 		return EFAULT;
 
 	if (version != DUMP_DATA_VERSION) {
@@ -2801,16 +5174,7 @@ static int dyn_dump(struct dump_info *di)
 		return ENOKEY;
 	}
 
-	/* get address of pointer to head of dump data */
-	ret = sym_address(di, "mcd_dump_data_head", &addr);
-	if (ret) {
-		info("libminicoredumper: no dump data found");
-		return ENOKEY;
-	}
-
-	/* read in pointer to head of dump data */
-	ret = read_remote(di, addr, &dd_addr, sizeof(unsigned long));
-	if (ret != 0)
+	if (ret < 2)
 		return EFAULT;
 
 	if (dd_addr == 0) {
@@ -2872,20 +5236,20 @@ static void dump_fat_core(struct dump_info *di)
 	free(buf);
 }
 
-static int copy_link(const char *dest, const char *src)
+static char *read_link(const char *src)
 {
 	struct stat sb;
 	char *linkname;
 	int ret;
 
 	if (lstat(src, &sb) != 0)
-		return -1;
+		return NULL;
 
 	/* stat/lstat is screwy for /proc/.../cwd, so
 	 * fallback to stat if lstat provides no size */
 	if (sb.st_size == 0) {
 		if (stat(src, &sb) != 0)
-			return -1;
+			return NULL;
 	}
 
 	/* set a sane value in case lstat/stat did not help */
@@ -2894,13 +5258,13 @@ static int copy_link(const char *dest, const char *src)
 
 	linkname = malloc(sb.st_size + 1);
 	if (!linkname)
-		return -1;
+		return NULL;
 
 	ret = readlink(src, linkname, sb.st_size + 1);
 	if (ret < 2) {
 		/* empty link? */
 		free(linkname);
-		return -1;
+		return NULL;
 	}
 	/* truncate when too long */
 	if (ret > sb.st_size)
@@ -2908,6 +5272,18 @@ static int copy_link(const char *dest, const char *src)
 	/* readlink does not terminate the string */
 	linkname[ret] = 0;
 
+	return linkname;
+}
+
+static int copy_link(const char *dest, const char *src)
+{
+	char *linkname;
+	int ret;
+
+	linkname = read_link(src);
+	if (!linkname)
+		return -1;
+
 	ret = symlink(linkname, dest);
 
 	free(linkname);
@@ -2915,6 +5291,109 @@ static int copy_link(const char *dest, const char *src)
 	return ret;
 }
 
+/*
+ * Capture a /proc entry of a live task in memory. It is created by
+ * write_deferred_proc() once the task has been resumed.
+ */
+static int defer_proc_entry(struct dump_info *di, const char *dest,
+			    const char *src, int type)
+{
+	struct deferred_proc *dp;
+	FILE *f_src = NULL;
+	FILE *file;
+
+	if (type == S_IFREG) {
+		f_src = open_src_file(src);
+		if (!f_src)
+			return -1;
+	}
+
+	dp = calloc(1, sizeof(*dp));
+	if (!dp)
+		goto out_err;
+
+	dp->type = type;
+	dp->path = strdup(dest);
+	if (!dp->path)
+		goto out_err;
+
+	if (type == S_IFREG) {
+		file = open_memstream(&dp->data, &dp->len);
+		if (!file)
+			goto out_err;
+		copy_stream(file, f_src);
+		fclose(file);
+		fclose(f_src);
+	} else if (type == S_IFLNK) {
+		dp->data = read_link(src);
+		if (!dp->data)
+			goto out_err;
+	}
+
+	if (!di->deferred_proc_tail)
+		di->deferred_proc_tail = &di->deferred_proc;
+	*di->deferred_proc_tail = dp;
+	di->deferred_proc_tail = &dp->next;
+
+	return 0;
+out_err:
+	if (f_src)
+		fclose(f_src);
+	if (dp) {
+		free(dp->path);
+		free(dp);
+	}
+	return -1;
+}
+
+/* create a directory of the /proc copy */
+static void proc_mkdir(struct dump_info *di, const char *path)
+{
+	/* do not keep a live task stopped for file output */
+	if (di->signum == 0)
+		defer_proc_entry(di, path, NULL, S_IFDIR);
+	else
+		mkdir(path, 0700);
+}
+
+/* copy a /proc file or link, path is the destination */
+static void proc_copy(struct dump_info *di, const char *path,
+		      size_t base_len, int link)
+{
+	if (di->signum == 0)
+		defer_proc_entry(di, path, path + base_len,
+				 link ? S_IFLNK : S_IFREG);
+	else if (link)
+		copy_link(path, path + base_len);
+	else
+		copy_file(path, path + base_len);
+}
+
+static void write_deferred_proc(struct dump_info *di)
+{
+	struct deferred_proc *dp;
+	FILE *file;
+
+	for (dp = di->deferred_proc; dp; dp = dp->next) {
+		if (dp->type == S_IFDIR) {
+			mkdir(dp->path, 0700);
+		} else if (dp->type == S_IFLNK) {
+			symlink(dp->data, dp->path);
+		} else {
+			file = fopen(dp->path, "w");
+			if (!file) {
+				info("unable to create \'%s\': %s", dp->path,
+				     strerror(errno));
+				continue;
+			}
+			fwrite(dp->data, dp->len, 1, file);
+			fclose(file);
+		}
+	}
+
+	free_deferred_proc(di);
+}
+
 static void copy_proc_files(struct dump_info *di, int tasks, const char *name,
 			    int link)
 {
@@ -2940,46 +5419,40 @@ static void copy_proc_files(struct dump_info *di, int tasks, const char *name,
 		do_fds = 1;
 
 	snprintf(path, size, "%s/proc", di->dst_dir);
-	mkdir(path, 0700);
+	proc_mkdir(di, path);
 	snprintf(path, size, "%s/proc/%d", di->dst_dir, di->pid);
-	mkdir(path, 0700);
+	proc_mkdir(di, path);
 
 	/* handle non-task file */
 	if (!tasks) {
 		snprintf(path, size, "%s/proc/%d/%s", di->dst_dir, di->pid,
 			 name);
-		if (link)
-			copy_link(path, path + base_len);
-		else
-			copy_file(path, path + base_len);
+		proc_copy(di, path, base_len, link);
 		free(path);
 		return;
 	}
 
 	snprintf(path, size, "%s/proc/%d/task", di->dst_dir, di->pid);
-	mkdir(path, 0700);
+	proc_mkdir(di, path);
 
 	for (i = 0 ; i < di->ntsks; i++) {
 		snprintf(path, size, "%s/proc/%d/task/%d", di->dst_dir,
 			 di->pid, di->tsks[i]);
-		mkdir(path, 0700);
+		proc_mkdir(di, path);
 
 		/* handle the normal task case */
 		if (!do_fds) {
 			snprintf(path, size, "%s/proc/%d/task/%d/%s",
 				 di->dst_dir, di->pid, di->tsks[i], name);
 
-			if (link)
-				copy_link(path, path + base_len);
-			else
-				copy_file(path, path + base_len);
+			proc_copy(di, path, base_len, link);
 			continue;
 		}
 
 		/* special case: copy the symlinks in the fd directory */
 		snprintf(path, size, "%s/proc/%d/task/%d/fd", di->dst_dir,
 			 di->pid, di->tsks[i]);
-		mkdir(path, 0700);
+		proc_mkdir(di, path);
 
 		d = opendir(path + base_len);
 		if (!d)
@@ -2998,7 +5471,7 @@ static void copy_proc_files(struct dump_info *di, int tasks, const char *name,
 				 di->dst_dir, di->pid, di->tsks[i],
 				 de->d_name);
 
-			copy_link(path, path + base_len);
+			proc_copy(di, path, base_len, 1);
 		}
 
 		closedir(d);
@@ -3200,12 +5673,17 @@ static int find_pthreads_cb(const td_thrhandle_t *th, void *cb_data)
 	return TD_OK;
 }
 
+/* libthread_db is not thread-safe, serialize the live dump workers */
+static pthread_mutex_t td_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void get_pthread_list(struct dump_info *di)
 {
 	struct ps_prochandle ph = { di };
 	td_thragent_t *ta;
 	td_err_e err;
 
+	pthread_mutex_lock(&td_lock);
+
 	err = td_ta_new(&ph, &ta);
 	if (err == TD_OK) {
 		err = td_ta_thr_iter(ta, find_pthreads_cb, NULL,
@@ -3215,6 +5693,8 @@ static void get_pthread_list(struct dump_info *di)
 		td_ta_delete(ta);
 	}
 
+	pthread_mutex_unlock(&td_lock);
+
 	if (err == TD_NOLIBTHREAD) {
 		info("target does not appear to be multi-threaded");
 	} else if (err != TD_OK) {
@@ -3242,14 +5722,20 @@ static unsigned long get_atval(ElfW(auxv_t) *elf_auxv, ElfW(Addr) type)
 static int init_from_auxv(struct dump_info *di, ElfW(auxv_t) *auxv,
 			  unsigned long *debug_ptr)
 {
+#define DYN_BATCH 64
+	struct remote_read rr[DYN_BATCH];
+	ElfW(Dyn) dyn[DYN_BATCH];
+	struct remote_read *ph_rr;
 	ElfW(Addr) relocation;
 	ElfW(Addr) phdr_addr;
 	ElfW(Addr) dyn_addr;
-	unsigned long addr;
-	uint32_t val32;
+	ElfW(Phdr) *phdr;
 	int found = 0;
+	int nread;
 	int max_ph;
+	int done;
 	int i;
+	int j;
 
 	max_ph = get_atval(auxv, AT_PHNUM);
 	phdr_addr = get_atval(auxv, AT_PHDR);
@@ -3257,39 +5743,40 @@ static int init_from_auxv(struct dump_info *di, ElfW(auxv_t) *auxv,
 	if (!phdr_addr)
 		return 1;
 
+	phdr = calloc(max_ph + 1, sizeof(*phdr));
+	ph_rr = calloc(max_ph + 1, sizeof(*ph_rr));
+	if (!phdr || !ph_rr) {
+		free(phdr);
+		free(ph_rr);
+		return 2;
+	}
+
+	/* read all program headers at once */
 	for (i = 0; i < max_ph; i++) {
-		/* val32 = (ElfW(Phdr))phdr_addr[i].p_type */
-		addr = phdr_addr + (sizeof(ElfW(Phdr)) * i) +
-		       offsetof(ElfW(Phdr), p_type);
-		if (read_remote(di, addr, &val32, sizeof(val32)) != 0)
-			break;
+		ph_rr[i].addr = phdr_addr + (sizeof(ElfW(Phdr)) * i);
+		ph_rr[i].dst = &phdr[i];
+		ph_rr[i].len = sizeof(ElfW(Phdr));
+	}
+	nread = read_remote_vec(di, ph_rr, max_ph);
 
-		if (val32 == PT_NULL) {
+	for (i = 0; i < nread; i++) {
+		if (phdr[i].p_type == PT_NULL) {
 			break;
 
-		} else if (val32 == PT_PHDR) {
-			addr = phdr_addr + (sizeof(ElfW(Phdr)) * i) +
-			       offsetof(ElfW(Phdr), p_vaddr);
-			if (read_remote(di, addr, &relocation,
-					sizeof(relocation)) != 0) {
-				break;
-			}
+		} else if (phdr[i].p_type == PT_PHDR) {
 			found |= 0x1;
 
-			relocation = phdr_addr - relocation;
+			relocation = phdr_addr - phdr[i].p_vaddr;
 
-		} else if (val32 == PT_DYNAMIC) {
-			/* dyn_addr = (ElfW(Phdr))phdr_addr[i].p_vaddr */
-			addr = phdr_addr + (sizeof(ElfW(Phdr)) * i) +
-			       offsetof(ElfW(Phdr), p_vaddr);
-			if (read_remote(di, addr, &dyn_addr,
-					sizeof(dyn_addr)) != 0) {
-				break;
-			}
+		} else if (phdr[i].p_type == PT_DYNAMIC) {
+			dyn_addr = phdr[i].p_vaddr;
 			found |= 0x2;
 		}
 	}
 
+	free(ph_rr);
+	free(phdr);
+
 	/* dump auxv phdrs to core */
 	if (di->cfg->prog_config.dump_auxv_so_list) {
 		dump_vma(di, phdr_addr, sizeof(ElfW(Phdr)) * i, 0,
@@ -3308,27 +5795,28 @@ static int init_from_auxv(struct dump_info *di, ElfW(auxv_t) *auxv,
 
 	dyn_addr = dyn_addr + relocation;
 
-	for (i = 0; ; i++) {
-		/* val32 = (ElfW(Dyn))dyn_addr[i].d_tag */
-		addr = dyn_addr + (sizeof(ElfW(Dyn)) * i)
-		       + offsetof(ElfW(Dyn), d_tag);
-		if (read_remote(di, addr, &val32, sizeof(val32)) != 0)
-			break;
-
-		if (val32 == DT_NULL) {
-			break;
+	/* read the dynamic section in batches until DT_NULL */
+	for (i = 0, done = 0; !done; ) {
+		for (j = 0; j < DYN_BATCH; j++) {
+			rr[j].addr = dyn_addr + (sizeof(ElfW(Dyn)) * (i + j));
+			rr[j].dst = &dyn[j];
+			rr[j].len = sizeof(ElfW(Dyn));
+		}
+		nread = read_remote_vec(di, rr, DYN_BATCH);
+		if (nread < DYN_BATCH)
+			done = 1;
 
-		} else if (val32 == DT_DEBUG) {
-			/* debug_ptr = (ElfW(Dyn))dyn_addr[i].d_un.d_ptr */
-			addr = dyn_addr + (sizeof(ElfW(Dyn)) * i) +
-			       offsetof(ElfW(Dyn), d_un.d_ptr);
-			if (read_remote(di, addr, debug_ptr,
-					sizeof(*debug_ptr)) != 0) {
+		for (j = 0; j < nread; j++, i++) {
+			if (dyn[j].d_tag == DT_NULL) {
+				done = 1;
 				break;
-			}
 
-			/* found it! */
-			found |= 0x4;
+			} else if (dyn[j].d_tag == DT_DEBUG) {
+				*debug_ptr = dyn[j].d_un.d_ptr;
+
+				/* found it! */
+				found |= 0x4;
+			}
 		}
 	}
 
@@ -3340,6 +5828,7 @@ static int init_from_auxv(struct dump_info *di, ElfW(auxv_t) *auxv,
 		return 5;
 
 	return 0;
+#undef DYN_BATCH
 }
 
 /* Get the shared libary list via /proc/pid/auxv */
@@ -3393,8 +5882,12 @@ static int get_so_list(struct dump_info *di)
 	}
 
 	while (ptr) {
+		struct remote_read rr[3];
+		unsigned long l_addr = 0;
 		unsigned long addr = 0;
+		unsigned long next = 0;
 		char *l_name = NULL;
+		int nread;
 
 		/* dump link_map */
 		if (di->cfg->prog_config.dump_auxv_so_list) {
@@ -3402,13 +5895,26 @@ static int get_so_list(struct dump_info *di)
 				 "auxv link_map");
 		}
 
-		/* get pointer to link_map name */
-		if (read_remote(di, ptr + offsetof(struct link_map, l_name),
-				&addr, sizeof(addr)) != 0) {
+		/* get pointers to link_map name, next link_map and
+		 * base address with a single read */
+		rr[0].addr = ptr + offsetof(struct link_map, l_name);
+		rr[0].dst = &addr;
+		rr[0].len = sizeof(addr);
+		rr[1].addr = ptr + offsetof(struct link_map, l_next);
+		rr[1].dst = &next;
+		rr[1].len = sizeof(next);
+		rr[2].addr = ptr + offsetof(struct link_map, l_addr);
+		rr[2].dst = &l_addr;
+		rr[2].len = sizeof(l_addr);
+
+		nread = read_remote_vec(di, rr, 3);
+		if (nread < 2) {
+			info("read_remote failed: link_map at 0x%lx: %s",
+			     ptr, strerror(errno));
 			return -1;
 		}
 
-		if (alloc_remote_string(di, addr, &l_name) == 0) {
+		if (alloc_remote_string(di, addr, PATH_MAX, &l_name) == 0) {
 			/* dump link_map name */
 			if (di->cfg->prog_config.dump_auxv_so_list) {
 				dump_vma(di, addr, strlen(l_name) + 1, 0,
@@ -3416,24 +5922,13 @@ static int get_so_list(struct dump_info *di)
 			}
 
 			/* store so data since we are here */
-			if (l_name[0] != 0) {
-				/* get pointer to base address */
-				if (read_remote(di,
-						ptr + offsetof(struct link_map,
-							       l_addr),
-						&addr, sizeof(addr)) == 0) {
-					store_sym_data(di, l_name, addr);
-				}
-			}
+			if (l_name[0] != 0 && nread == 3)
+				store_sym_data(di, l_name, l_addr);
 
 			free(l_name);
 		}
 
-		/* get pointer to next link_map */
-		if (read_remote(di, ptr + offsetof(struct link_map, l_next),
-				&ptr, sizeof(ptr)) != 0) {
-			return -1;
-		}
+		ptr = next;
 	}
 
 	return 0;
@@ -3499,38 +5994,45 @@ static void write_proc_info(struct dump_info *di)
 	copy_proc_files(di, 1, "fd", 1);
 }
 
-#ifdef SUPPORT_LIBELF_MODIFY
+/*
+ * The dump list is appended behind the core, the notes are not touched.
+ */
 static int add_dumplist_section(struct dump_info *di)
 {
 	size_t core_size = di->core_file_size;
 	off64_t dump_offset;
 
-	if (add_dump_list(di->elf_fd, &core_size, di->core_file,
-			  &dump_offset) != 0) {
+	if (!di->elf_hdr)
+		return -1;
+
+	if (append_dump_list(di->elf_fd, di->elf_hdr, &core_size,
+			     di->core_file, &dump_offset) != 0) {
 		return -1;
 	}
 
 	di->core_file_size = core_size;
-	check_core_size(di);
 
 	add_core_data(di, dump_offset, core_size - dump_offset,
 		      di->elf_fd, dump_offset);
 
 	return 0;
 }
-#endif
 
-static void do_dump(struct dump_info *di, int argc, char *argv[])
+/*
+ * Capture phase of a dump: everything that needs the task itself. A live
+ * task is resumed right after this. Returns 0 if there is something to emit.
+ */
+static int dump_capture(struct dump_info *di, int argc, char *argv[])
 {
 	int ret;
 
 	ret = init_di(di, argc, argv);
 	if (ret == 1) {
 		info("unable to create new dump info instance");
-		goto out;
+		return -1;
 	} else if (ret == 2) {
 		info("no watch for comm=%s exe=%s", di->comm, di->exe);
-		goto out;
+		return -1;
 	}
 
 	if (init_log(di) != 0)
@@ -3541,10 +6043,18 @@ static void do_dump(struct dump_info *di, int argc, char *argv[])
 		if (init_src_core(di, STDIN_FILENO) != 0)
 			fatal("unable to initialize core");
 
+		/* the rest of the core is read at emission (if configured) */
+		if (di->cfg->prog_config.stream_core &&
+		    core_stream_start(di, STDIN_FILENO) != 0) {
+			info("WARNING: unable to stream core");
+		}
+
 		/* log the vma info we found */
 		log_vmas(di);
 	} else {
 		dump_maps(di, 1);
+		if (build_vma_index(di) != 0)
+			info("failed to index vmas");
 	}
 
 	/* copy intersting /proc data (if configured) */
@@ -3579,39 +6089,72 @@ static void do_dump(struct dump_info *di, int argc, char *argv[])
 	/* dump registered application data */
 	dyn_dump(di);
 
+	return 0;
+}
+
+/*
+ * Emission phase of a dump: write (and compress) the dump files, then
+ * clean up. The task is not accessed anymore, except for the core.
+ */
+static void dump_emit(struct dump_info *di, int ret)
+{
+	/* nothing was captured */
+	if (ret != 0)
+		goto out;
+
 	if (di->core_fd >= 0) {
-#ifdef SUPPORT_LIBELF_MODIFY
+		/* write the fat core while the core is emitted (if configured) */
+		if (di->cfg->prog_config.dump_fat_core &&
+		    fat_pass_start(di) != 0) {
+			info("WARNING: fat core is written separately");
+		}
+
 		/* add a new elf section containing the dump list */
 		if (add_dumplist_section(di) != 0)
 			info("WARNING: failed to add dump list");
-#else
-		info("WARNING: libelf too old to support dump list");
-#endif
 
 		/* dump data to compressed tar'd sparse core file */
-		if (dump_compressed_tar(di) != 0) {
+		if (dump_compressed_tar(di) != 0 && core_fallback_ok(di)) {
 			/* dump data to compressed core file */
-			if (dump_compressed_core(di) != 0) {
+			if (dump_compressed_core(di) != 0 &&
+			    core_fallback_ok(di)) {
 				/* dump data to sparse core file */
 				dump_mini_core(di);
 			}
 		}
 
 		/* dump a fat core (if configured) */
-		if (di->cfg->prog_config.dump_fat_core)
+		if (di->fat)
+			fat_pass_finish(di);
+		else if (di->cfg->prog_config.dump_fat_core)
 			dump_fat_core(di);
 	} else {
+		/* write the captured file dumps */
+		write_deferred_files(di);
+
+		/* write the captured /proc data */
+		write_deferred_proc(di);
+
 		info("dump path: %s", di->dst_dir);
 	}
 out:
+	log_page_cache(di);
+
 	/* we are done, cleanup */
 	cleanup_di(di);
 }
 
+static void do_dump(struct dump_info *di, int argc, char *argv[])
+{
+	dump_emit(di, dump_capture(di, argc, argv));
+}
+
 static long ptrace_tree(enum __ptrace_request request, pid_t pid)
 {
 	char buf[64];
 	struct dirent *de;
+	int status;
+	pid_t tid;
 	DIR *d;
 
 	snprintf(buf, sizeof(buf), "/proc/%d/task", pid);
@@ -3625,7 +6168,13 @@ static long ptrace_tree(enum __ptrace_request request, pid_t pid)
 			break;
 		if (de->d_name[0] == '.')
 			continue;
-		ptrace(request, atoi(de->d_name), NULL, NULL);
+		tid = atoi(de->d_name);
+		if (ptrace(request, tid, NULL, NULL) != 0)
+			continue;
+
+		/* a task can only be detached once it has stopped */
+		if (request == PTRACE_INTERRUPT)
+			waitpid(tid, &status, __WALL);
 	}
 
 	closedir(d);
@@ -3705,10 +6254,246 @@ out:
 	munmap(sh, map_size);
 }
 
+/* upper limit of parallel live dump workers */
+#define LIVE_DUMP_MAX_THREADS 64
+
+/* registered tasks, shared by all live dump workers */
+struct live_dump {
+	pthread_mutex_t m;
+	pthread_cond_t c;
+	pid_t core_pid;
+	pid_t *pids;
+	int n;
+	int next;	/* next task to pause */
+	int done;	/* tasks paused (or skipped) */
+	char *dst_dir;
+	int argc;
+	char **argv;
+};
+
+/* a registered task paused by a live dump worker */
+struct live_task {
+	pid_t pid;
+	struct timespec paused;
+	/* time the task was kept stopped */
+	long frozen_us;
+};
+
+struct live_worker {
+	struct live_dump *ld;
+	struct dump_info di;
+	pthread_t thread;
+	struct live_task *tasks;
+	int n;
+};
+
+static long elapsed_us(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((now.tv_sec - start->tv_sec) * 1000000L) +
+	       ((now.tv_nsec - start->tv_nsec) / 1000);
+}
+
+/*
+ * Since the tracer of a task is the thread that seized it, each worker
+ * pauses, dumps and resumes its own tasks. Tasks are handed out while
+ * pausing and no dump starts before all registered tasks are paused.
+ * A task is resumed as soon as its data is captured, the dump files are
+ * written afterwards.
+ */
+static void *live_dump_worker(void *arg)
+{
+	struct live_worker *w = arg;
+	struct live_dump *ld = w->ld;
+	struct live_task *t;
+	char *ext_argv[10];
+	char pidstr[16];
+	pid_t pid;
+	int ret;
+	int i;
+
+	worker_di = &w->di;
+
+	/* pause tasks until none are left */
+	pthread_mutex_lock(&ld->m);
+	while (ld->next < ld->n) {
+		pid = ld->pids[ld->next++];
+		pthread_mutex_unlock(&ld->m);
+
+		if (pid != 0 && pid != ld->core_pid &&
+		    ptrace_tree(PTRACE_SEIZE, pid) == 0) {
+			ptrace_tree(PTRACE_INTERRUPT, pid);
+			t = &w->tasks[w->n++];
+			t->pid = pid;
+			clock_gettime(CLOCK_MONOTONIC, &t->paused);
+		}
+
+		pthread_mutex_lock(&ld->m);
+		ld->done++;
+	}
+
+	/* wait until all registered tasks are paused */
+	pthread_cond_broadcast(&ld->c);
+	while (ld->done < ld->n)
+		pthread_cond_wait(&ld->c, &ld->m);
+	pthread_mutex_unlock(&ld->m);
+
+	memcpy(ext_argv, ld->argv, sizeof(ext_argv));
+	ext_argv[1] = &pidstr[0];
+
+	/* dump own tasks, resuming each as soon as it is captured */
+	for (i = 0; i < w->n; i++) {
+		t = &w->tasks[i];
+
+		snprintf(pidstr, sizeof(pidstr), "%d", t->pid);
+		w->di.dst_dir = ld->dst_dir;
+
+		ret = dump_capture(&w->di, ld->argc, ext_argv);
+
+		ptrace_tree(PTRACE_DETACH, t->pid);
+		t->frozen_us = elapsed_us(&t->paused);
+
+		dump_emit(&w->di, ret);
+
+		info("live dump: pid %d frozen for %ld us", t->pid,
+		     t->frozen_us);
+	}
+
+#ifdef SUPPORT_ZERO_COPY
+	close_zc_pipe();
+#endif
+	worker_di = NULL;
+
+	return NULL;
+}
+
+/*
+ * Dump all registered tasks. The dumped tasks, with the time each was
+ * kept stopped, are returned in @tasks.
+ */
+static void do_live_dumps(struct dump_info *di, pid_t core_pid, int nthreads,
+			  int argc, char *argv[], struct live_task **tasks,
+			  int *ntasks)
+{
+	struct live_worker *w;
+	struct live_dump ld;
+	int started;
+	int i;
+
+	*tasks = NULL;
+	*ntasks = 0;
+
+	memset(&ld, 0, sizeof(ld));
+	pthread_mutex_init(&ld.m, NULL);
+	pthread_cond_init(&ld.c, NULL);
+	ld.core_pid = core_pid;
+	ld.dst_dir = di->dst_dir;
+	ld.argc = argc;
+	ld.argv = argv;
+
+	alloc_registered_pids(core_pid, &ld.pids, &ld.n);
+	if (ld.n == 0)
+		goto out;
+
+	if (nthreads == 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > LIVE_DUMP_MAX_THREADS)
+		nthreads = LIVE_DUMP_MAX_THREADS;
+	if (nthreads > ld.n)
+		nthreads = ld.n;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	w = calloc(nthreads, sizeof(*w));
+	if (!w)
+		goto out;
+
+	for (i = 0; i < nthreads; i++) {
+		w[i].ld = &ld;
+		w[i].tasks = malloc(sizeof(*w[i].tasks) * ld.n);
+		if (!w[i].tasks)
+			break;
+	}
+	nthreads = i;
+	if (nthreads == 0)
+		goto out_free;
+
+	/*
+	 * The calling thread is the first worker. If a thread cannot be
+	 * created, the remaining workers pick up its tasks.
+	 */
+	started = 1;
+	for (i = 1; i < nthreads; i++) {
+		if (pthread_create(&w[i].thread, NULL, live_dump_worker,
+				   &w[i]) != 0) {
+			info("unable to create live dump thread");
+			break;
+		}
+		started++;
+	}
+
+	live_dump_worker(&w[0]);
+
+	for (i = 1; i < started; i++)
+		pthread_join(w[i].thread, NULL);
+
+	*tasks = malloc(sizeof(**tasks) * ld.n);
+	if (*tasks) {
+		for (i = 0; i < nthreads; i++) {
+			memcpy(*tasks + *ntasks, w[i].tasks,
+			       sizeof(**tasks) * w[i].n);
+			*ntasks += w[i].n;
+		}
+	}
+out_free:
+	for (i = 0; i < nthreads; i++)
+		free(w[i].tasks);
+	free(w);
+out:
+	if (ld.pids)
+		free(ld.pids);
+	pthread_cond_destroy(&ld.c);
+	pthread_mutex_destroy(&ld.m);
+}
+
+/* append the freeze times of the live dumped tasks to the debug log */
+static void log_freeze_times(const char *dst_dir, struct live_task *tasks,
+			     int ntasks)
+{
+	char *tmp_path;
+	FILE *f;
+	int i;
+
+	if (asprintf(&tmp_path, "%s/debug.txt", dst_dir) == -1)
+		return;
+
+	f = fopen(tmp_path, "a");
+	free(tmp_path);
+	if (!f)
+		return;
+
+	fprintf(f, "Live Dump Freeze Times\n");
+	fprintf(f, "----------------------\n");
+	for (i = 0; i < ntasks; i++) {
+		fprintf(f, "PID: %i frozen: %ld.%06ld s\n", tasks[i].pid,
+			tasks[i].frozen_us / 1000000,
+			tasks[i].frozen_us % 1000000);
+	}
+
+	fclose(f);
+}
+
 static int do_all_dumps(struct dump_info *di, int argc, char *argv[])
 {
 	struct config *cfg = NULL;
 	const char *recept;
+	struct live_task *frozen = NULL;
+	int live_dumper_threads;
+	bool write_debug_log;
+	int nfrozen = 0;
 	bool live_dumper;
 	char *comm_base;
 	pid_t core_pid;
@@ -3743,6 +6528,9 @@ static int do_all_dumps(struct dump_info *di, int argc, char *argv[])
 
 	check_config(cfg);
 
+	/* parsed once, shared by all dumps */
+	base_cfg = cfg;
+
 	core_pid = strtol(argv[1], &p, 10);
 	if (*p != 0)
 		return 1;
@@ -3783,60 +6571,29 @@ static int do_all_dumps(struct dump_info *di, int argc, char *argv[])
 		return 1;
 
 	live_dumper = cfg->prog_config.live_dumper;
+	live_dumper_threads = cfg->prog_config.live_dumper_threads;
+	write_debug_log = cfg->prog_config.write_debug_log;
 
-	free_config(cfg);
 	free(comm);
 	free(exe);
 
-	if (live_dumper) {
-		char pidstr[16];
-		pid_t *pids;
-		int n;
-		int i;
-
-		alloc_registered_pids(core_pid, &pids, &n);
-
-		/* pause all registered tasks */
-		for (i = 0; i < n; i++) {
-			if (pids[i] == 0)
-				continue;
-			if (pids[i] == core_pid)
-				continue;
-			if (ptrace_tree(PTRACE_SEIZE, pids[i]) != 0)
-				pids[i] = 0;
-			else
-				ptrace_tree(PTRACE_INTERRUPT, pids[i]);
-		}
-
-		/* dump all registered tasks */
-		for (i = 0; i < n; i++) {
-			if (pids[i] == 0)
-				continue;
-			if (pids[i] == core_pid)
-				continue;
-			snprintf(pidstr, sizeof(pidstr), "%d", pids[i]);
-			ext_argv[1] = &pidstr[0];
-			do_dump(di, argc, ext_argv);
-		}
-
-		/* resume all registered tasks */
-		for (i = 0; i < n; i++) {
-			if (pids[i] == 0)
-				continue;
-			if (pids[i] == core_pid)
-				continue;
-			ptrace_tree(PTRACE_DETACH, pids[i]);
-		}
-
-		if (pids)
-			free(pids);
-	}
+	if (live_dumper)
+		do_live_dumps(di, core_pid, live_dumper_threads, argc, ext_argv,
+			      &frozen, &nfrozen);
 
 	if (core_pid != 0) {
 		/* dump crashed task */
 		do_dump(di, argc, argv);
 	}
 
+	/* after the crashed task, which creates the debug log */
+	if (nfrozen > 0 && write_debug_log)
+		log_freeze_times(di->dst_dir, frozen, nfrozen);
+	if (frozen)
+		free(frozen);
+
+	base_cfg = NULL;
+	free_config(cfg);
 	free(di->dst_dir);
 
 	return 0;
@@ -3845,6 +6602,7 @@ static int do_all_dumps(struct dump_info *di, int argc, char *argv[])
 int main(int argc, char *argv[])
 {
 	struct dump_info di;
+	int ret;
 
 	memset(&di, 0, sizeof(di));
 
@@ -3854,6 +6612,25 @@ int main(int argc, char *argv[])
 	/* determine page size */
 	PAGESZ = sysconf(_SC_PAGESIZE);
 
+	/* validate and compile the config, then exit */
+	if (argc >= 2 && strcmp(argv[1], "--compile-config") == 0) {
+		/* also log to stderr */
+		openlog("minicoredumper", LOG_NDELAY | LOG_PERROR,
+			LOG_SYSLOG);
+
+		if (argc > 3)
+			fatal("wrong amount of command line parameters");
+
+		if (argc == 3)
+			ret = compile_config(argv[2]);
+		else
+			ret = compile_config(MCD_CONF_PATH
+					     "/minicoredumper.cfg.json");
+
+		closelog();
+		return (ret == 0 ? 0 : 1);
+	}
+
 	/* create all files only owner-readable */
 	umask(077);
 
@@ -3872,6 +6649,10 @@ int main(int argc, char *argv[])
 
 	do_all_dumps(&di, argc, argv);
 
+#ifdef SUPPORT_ZERO_COPY
+	close_zc_pipe();
+#endif
+
 	closelog();
 	munlockall();
 
@@ -8,10 +8,13 @@
 #define __CORESTRIPPER_H__
 
 #include <stdio.h>
+#include <stdint.h>
 #include <libelf.h>
 #include <gelf.h>
 
 struct core_data;
+struct core_data_node;
+struct sym_cache;
 
 /* dumpable vmas found in the core file */
 struct core_vma {
@@ -31,6 +34,18 @@ struct interesting_vma {
 	struct interesting_vma *next;
 };
 
+/* GNU hash table of an object (.gnu.hash) */
+struct gnu_hash {
+	uint32_t nbuckets;
+	uint32_t symoffset;
+	uint32_t bloom_size;
+	uint32_t bloom_shift;
+	const void *bloom;
+	const uint32_t *buckets;
+	const uint32_t *chain;
+	uint32_t nchain;
+};
+
 struct sym_data {
 	unsigned long start;
 	Elf *elf;
@@ -38,19 +53,96 @@ struct sym_data {
 	Elf_Data *data;
 	int fd;
 	int count;
+	int elfclass;
+
+	/* the object's own hash table (if it has one) */
+	struct gnu_hash *gnu_hash;
+
+	/* otherwise a hash index built on first lookup */
+	uint32_t nbuckets;
+	uint32_t *buckets;
+	uint32_t *chain;
+	uint32_t *hashes;
+
+	/* on-disk symbol index replacing all of the above */
+	struct sym_cache *cache;
 
 	struct sym_data *next;
 };
 
+/* pages of target memory read during one dump */
+struct page_cache {
+	unsigned long *addr;
+	char *data;
+	unsigned long hits;
+	unsigned long misses;
+};
+
+/* state of the core stream read in streaming mode */
+struct core_stream {
+	int fd;
+	off64_t pos;
+	/* stream offset before any target memory was read */
+	off64_t start;
+	int null_fd;
+	char *skip_buf;
+
+	/* stream data already copied with the header */
+	char *head;
+	off64_t head_start;
+	size_t head_len;
+
+	/* index of the vma of the last request */
+	int vma;
+};
+
+/* state of the combined fat core pass */
+struct fat_pass {
+	/* index of the current vma in the vma index */
+	int vma;
+	unsigned long pos;
+	char *buf;
+	unsigned long buf_addr;
+	size_t buf_len;
+};
+
+/* registered file dump of a live task, written once the task is resumed */
+struct deferred_file {
+	char *ident;
+	int bin;
+	char *data;
+	size_t len;
+	struct deferred_file *next;
+};
+
+/*
+ * /proc entry of a live task, read while the task is stopped and written
+ * once it is resumed. The type is S_IFDIR, S_IFREG or S_IFLNK.
+ */
+struct deferred_proc {
+	char *path;
+	int type;
+	char *data;
+	size_t len;
+	struct deferred_proc *next;
+};
+
 struct dump_info {
 	struct config *cfg;
 
 	char *dst_dir;
 	char *core_path;
 	int mem_fd;
+	int no_vm_readv;
+	struct page_cache page_cache;
 	int elf_fd;
+	/* the headers of the core, up to the first vma */
+	char *elf_hdr;
+	size_t elf_hdr_size;
 	int core_fd;
 	int fatcore_fd;
+	struct fat_pass *fat;
+	struct core_stream *stream;
 
 	off64_t core_offset;
 	off64_t core_start_offset;
@@ -79,8 +171,21 @@ struct dump_info {
 	unsigned long vma_end;
 	struct core_vma *vma;
 
+	/* vmas sorted by address, for lookups */
+	struct core_vma **vma_index;
+	int nvmas;
+	int vma_last;
+
 	struct core_data *core_file;
+	struct core_data_node *core_tree;
 	off64_t core_file_size;
+
+	/* file dumps captured while the (live) task is stopped */
+	struct deferred_file *deferred;
+
+	/* /proc data captured while the (live) task is stopped */
+	struct deferred_proc *deferred_proc;
+	struct deferred_proc **deferred_proc_tail;
 };
 
 int add_core_data(struct dump_info *di, off64_t dest_offset, size_t len,
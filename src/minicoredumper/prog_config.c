@@ -12,9 +12,13 @@
 #include <string.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <pthread.h>
 #include <json-c/json.h>
 
 #include "prog_config.h"
@@ -22,6 +26,9 @@
 void info(const char *fmt, ...);
 void fatal(const char *fmt, ...);
 
+/* protects the recept list of the base config */
+static pthread_mutex_t recept_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static char *alloc_json_string(struct json_object *o)
 {
 	const char *v;
@@ -172,6 +179,53 @@ static int read_prog_compression_config(struct json_object *root,
 				cfg->core_compressor = NULL;
 			}
 
+		} else if (strcmp(n, "method") == 0) {
+			const char *m;
+
+			if (!json_object_is_type(v, json_type_string))
+				return -1;
+
+			m = json_object_get_string(v);
+			if (!m)
+				return -1;
+
+			if (strcmp(m, "external") == 0) {
+				cfg->core_compress_method = COMPRESS_EXTERNAL;
+			} else if (strcmp(m, "zstd") == 0) {
+				cfg->core_compress_method = COMPRESS_ZSTD;
+			} else if (strcmp(m, "gzip") == 0) {
+				cfg->core_compress_method = COMPRESS_GZIP;
+			} else if (strcmp(m, "xz") == 0) {
+				cfg->core_compress_method = COMPRESS_XZ;
+			} else {
+				info("invalid compression method: %s", m);
+				return -1;
+			}
+
+		} else if (strcmp(n, "level") == 0) {
+			if (get_json_int(v, &cfg->core_compress_level,
+					 true) != 0) {
+				return -1;
+			}
+
+		} else if (strcmp(n, "threads") == 0) {
+			if (get_json_int(v, &cfg->core_compress_threads,
+					 true) != 0) {
+				return -1;
+			}
+
+		} else if (strcmp(n, "seekable") == 0) {
+			if (get_json_boolean(v,
+					     &cfg->core_compress_seekable) != 0) {
+				return -1;
+			}
+
+		} else if (strcmp(n, "sparse") == 0) {
+			if (get_json_boolean(v,
+					     &cfg->core_compress_sparse) != 0) {
+				return -1;
+			}
+
 		} else if (strcmp(n, "extension") == 0) {
 			if (cfg->core_compressor_ext)
 				free(cfg->core_compressor_ext);
@@ -379,6 +433,10 @@ static int read_prog_config(struct json_object *root, struct prog_config *cfg)
 			if (get_json_boolean(v, &cfg->dump_fat_core) != 0)
 				return -1;
 
+		} else if (strcmp(n, "stream_core") == 0) {
+			if (get_json_boolean(v, &cfg->stream_core) != 0)
+				return -1;
+
 		} else if (strcmp(n, "dump_auxv_so_list") == 0) {
 			if (get_json_boolean(v, &cfg->dump_auxv_so_list) != 0)
 				return -1;
@@ -405,6 +463,12 @@ static int read_prog_config(struct json_object *root, struct prog_config *cfg)
 			if (get_json_boolean(v, &cfg->live_dumper) != 0)
 				return -1;
 
+		} else if (strcmp(n, "live_dumper_threads") == 0) {
+			if (get_json_int(v, &cfg->live_dumper_threads,
+					 true) != 0) {
+				return -1;
+			}
+
 		} else {
 			info("WARNING: ignoring unknown config item: %s", n);
 		}
@@ -413,41 +477,185 @@ static int read_prog_config(struct json_object *root, struct prog_config *cfg)
 	return 0;
 }
 
-/* match '*' to 0 or more characters */
-int simple_match(const char *pattern, const char *string)
+/*
+ * Compiled glob pattern, where '*' matches 0 or more characters. The
+ * pattern is split at the wildcards into segments that are matched
+ * without backtracking: the first segment must be a prefix, the last
+ * segment a suffix and the segments in between are taken at their
+ * leftmost position. With memmem() (two-way) each match is linear.
+ *
+ * A compiled glob is a single block that only contains offsets, so it
+ * can be copied as is (see the compiled config image).
+ */
+#define GLOB_LEAD_STAR	0x1
+#define GLOB_TRAIL_STAR	0x2
+
+struct glob_seg {
+	uint32_t off;
+	uint32_t len;
+};
+
+struct glob {
+	uint32_t size;
+	uint32_t nsegs;
+	uint32_t flags;
+	uint32_t reserved;
+	struct glob_seg seg[];
+};
+
+static struct glob *glob_compile(const char *pattern)
 {
-	if (*pattern == 0 && *string == 0) {
-		/* reached the end of both strings => match! */
-		return 0;
+	const char *p = pattern;
+	struct glob *g;
+	uint32_t nsegs = 0;
+	size_t chars = 0;
+	size_t size;
+	char *dst;
+	size_t len;
+
+	/* count the segments */
+	while (*p) {
+		p += strspn(p, "*");
+		len = strcspn(p, "*");
+		if (len == 0)
+			break;
+		nsegs++;
+		chars += len;
+		p += len;
 	}
 
-	/* handle wildcard */
-	if (*pattern == '*') {
-		/* skip consecutive wildcards */
-		while (*(pattern + 1) == '*')
-			pattern++;
+	size = sizeof(*g) + (nsegs * sizeof(g->seg[0])) + chars;
+	if (size > UINT32_MAX)
+		return NULL;
 
-		/* characters after a wildcard must be present in string */
-		if (*(pattern + 1) != 0 && *string == 0)
-			return -1;
+	g = calloc(1, size);
+	if (!g)
+		return NULL;
 
-		/* try ignoring wildcard */
-		if (simple_match(pattern + 1, string) == 0)
-			return 0;
+	g->size = size;
+	if (pattern[0] == '*')
+		g->flags |= GLOB_LEAD_STAR;
+	if (pattern[0] && pattern[strlen(pattern) - 1] == '*')
+		g->flags |= GLOB_TRAIL_STAR;
+
+	dst = (char *)&g->seg[nsegs];
+	p = pattern;
+	while (g->nsegs < nsegs) {
+		p += strspn(p, "*");
+		len = strcspn(p, "*");
+
+		g->seg[g->nsegs].off = dst - (char *)g;
+		g->seg[g->nsegs].len = len;
+		g->nsegs++;
+
+		memcpy(dst, p, len);
+		dst += len;
+		p += len;
+	}
 
-		/* try matching string character with wildcard */
-		if (simple_match(pattern, string + 1) == 0)
+	return g;
+}
+
+/* Returns 0 if @string matches, like simple_match(). */
+int glob_match(const struct glob *g, const char *string)
+{
+	const struct glob_seg *seg = g->seg;
+	const char *base = (const char *)g;
+	size_t n = strlen(string);
+	uint32_t first = 0;
+	uint32_t last = g->nsegs;
+	size_t pos = 0;
+	const char *p;
+
+	if (g->nsegs == 0) {
+		/* "" only matches "", wildcards match everything */
+		if (g->flags & GLOB_LEAD_STAR)
 			return 0;
+		return (n == 0 ? 0 : -1);
+	}
 
-		return -1;
+	/* no leading wildcard: the first segment is a prefix */
+	if (!(g->flags & GLOB_LEAD_STAR)) {
+		if (seg[0].len > n ||
+		    memcmp(string, base + seg[0].off, seg[0].len) != 0) {
+			return -1;
+		}
+		pos = seg[0].len;
+		first = 1;
+
+		/* no wildcard at all */
+		if (g->nsegs == 1 && !(g->flags & GLOB_TRAIL_STAR))
+			return (pos == n ? 0 : -1);
+	}
+
+	/* no trailing wildcard: the last segment is a suffix */
+	if (!(g->flags & GLOB_TRAIL_STAR)) {
+		last--;
+		if (seg[last].len > n - pos ||
+		    memcmp(string + n - seg[last].len, base + seg[last].off,
+			   seg[last].len) != 0) {
+			return -1;
+		}
+		n -= seg[last].len;
+	}
+
+	/* the segments in between, each at the leftmost position */
+	for (; first < last; first++) {
+		p = memmem(string + pos, n - pos, base + seg[first].off,
+			   seg[first].len);
+		if (!p)
+			return -1;
+		pos = (p - string) + seg[first].len;
 	}
 
-	/* handle non-wildcard */
-	if (*pattern != *string)
+	return 0;
+}
+
+/* match '*' to 0 or more characters */
+int simple_match(const char *pattern, const char *string)
+{
+	struct glob *g;
+	int ret;
+
+	g = glob_compile(pattern);
+	if (!g)
 		return -1;
 
-	/* continue matching */
-	return simple_match(pattern + 1, string + 1);
+	ret = glob_match(g, string);
+
+	free(g);
+
+	return ret;
+}
+
+static int rule_match(const struct glob *g, const char *pattern,
+		      const char *string)
+{
+	if (g)
+		return glob_match(g, string);
+
+	/* not compiled (out of memory) */
+	return simple_match(pattern, string);
+}
+
+/* compile the map globs (if this fails, they are matched uncompiled) */
+static void compile_map_globs(struct maps_config *cfg)
+{
+	size_t i;
+
+	if (cfg->nglobs == 0)
+		return;
+
+	cfg->name_globs_compiled = calloc(cfg->nglobs,
+					  sizeof(struct glob *));
+	if (!cfg->name_globs_compiled)
+		return;
+
+	for (i = 0; i < cfg->nglobs; i++) {
+		if (!cfg->name_globs[i])
+			continue;
+		cfg->name_globs_compiled[i] = glob_compile(cfg->name_globs[i]);
+	}
 }
 
 const char *get_prog_recept(struct config *cfg, const char *comm,
@@ -462,8 +670,8 @@ const char *get_prog_recept(struct config *cfg, const char *comm,
 
 		/* both defined = both rules must match */
 		if (tmp->comm && tmp->exe) {
-			if (simple_match(tmp->comm, comm) == 0 &&
-			    simple_match(tmp->exe, exe) == 0) {
+			if (rule_match(tmp->comm_glob, tmp->comm, comm) == 0 &&
+			    rule_match(tmp->exe_glob, tmp->exe, exe) == 0) {
 				return tmp->recept;
 			}
 			continue;
@@ -471,14 +679,14 @@ const char *get_prog_recept(struct config *cfg, const char *comm,
 
 		/* match only against comm */
 		if (tmp->comm) {
-			if (simple_match(tmp->comm, comm) == 0)
+			if (rule_match(tmp->comm_glob, tmp->comm, comm) == 0)
 				return tmp->recept;
 			continue;
 		}
 
 		/* match only against exe */
 		if (tmp->exe) {
-			if (simple_match(tmp->exe, exe) == 0)
+			if (rule_match(tmp->exe_glob, tmp->exe, exe) == 0)
 				return tmp->recept;
 			continue;
 		}
@@ -555,6 +763,12 @@ static int read_watch_elem(struct json_object *root, struct config *cfg)
 	if (!tmp->recept)
 		tmp->recept = strdup("");
 
+	/* compile the rules (if this fails, they are matched uncompiled) */
+	if (tmp->comm)
+		tmp->comm_glob = glob_compile(tmp->comm);
+	if (tmp->exe)
+		tmp->exe_glob = glob_compile(tmp->exe);
+
 	/* new item must be appended because rules are ordered */
 
 	if (!cfg->ilist) {
@@ -633,6 +847,15 @@ static int read_base_config(struct json_object *root, struct config *cfg)
 			if (!cfg->base_dir)
 				return -1;
 
+		} else if (strcmp(n, "symbol_cache_dir") == 0) {
+			cfg->sym_cache_dir = alloc_json_string(v);
+			if (!cfg->sym_cache_dir)
+				return -1;
+
+		} else if (strcmp(n, "io_uring") == 0) {
+			if (get_json_boolean(v, &cfg->io_uring) != 0)
+				return -1;
+
 		} else {
 			info("WARNING: ignoring unknown config item: %s", n);
 		}
@@ -641,7 +864,7 @@ static int read_base_config(struct json_object *root, struct config *cfg)
 	return 0;
 }
 
-struct config *init_config(const char *cfg_file)
+static struct config *read_config_file(const char *cfg_file)
 {
 	struct json_object *o;
 	struct config *cfg;
@@ -681,25 +904,65 @@ static void set_config_defaults(struct prog_config *cfg)
 
 	/* do not dump non-crashing registered applications */
 	cfg->live_dumper = false;
+	cfg->live_dumper_threads = 1;
 
 	/* no debugging data */
 	cfg->write_proc_info = false;
 	cfg->write_debug_log = false;
 	cfg->dump_fat_core = false;
+	cfg->stream_core = false;
 
 	/* dump everything */
 	cfg->dump_scope = -1;
 
 	/* for compression, pack in tarball */
 	cfg->core_in_tar = true;
+
+	/* use the compressor command, if any */
+	cfg->core_compress_method = COMPRESS_EXTERNAL;
+	cfg->core_compress_level = -1;
+	cfg->core_compress_threads = 1;
+	cfg->core_compress_seekable = false;
+	cfg->core_compress_sparse = false;
 }
 
-int init_prog_config(struct config *cfg, const char *cfg_file)
+static void free_prog_config(struct prog_config *cfg)
+{
+	struct interesting_buffer *buf;
+	int i;
+
+	for (i = 0; i < cfg->maps.nglobs; i++)
+		free(cfg->maps.name_globs[i]);
+	if (cfg->maps.name_globs)
+		free(cfg->maps.name_globs);
+	if (cfg->maps.name_globs_compiled) {
+		for (i = 0; i < cfg->maps.nglobs; i++)
+			free(cfg->maps.name_globs_compiled[i]);
+		free(cfg->maps.name_globs_compiled);
+	}
+
+	while (cfg->buffers) {
+		buf = cfg->buffers;
+		cfg->buffers = buf->next;
+		if (buf->symname)
+			free(buf->symname);
+		if (buf->ident)
+			free(buf->ident);
+		free(buf);
+	}
+
+	if (cfg->core_compressor)
+		free(cfg->core_compressor);
+	if (cfg->core_compressor_ext)
+		free(cfg->core_compressor_ext);
+}
+
+static int read_recept(const char *cfg_file, struct prog_config *cfg)
 {
 	struct json_object *o;
 	int ret;
 
-	set_config_defaults(&cfg->prog_config);
+	set_config_defaults(cfg);
 
 	/* recept "" means use defaults */
 	if (cfg_file[0] == 0)
@@ -711,21 +974,122 @@ int init_prog_config(struct config *cfg, const char *cfg_file)
 		return -1;
 	}
 
-	ret = read_prog_config(o, &cfg->prog_config);
+	ret = read_prog_config(o, cfg);
+	if (ret == 0)
+		compile_map_globs(&cfg->maps);
 
 	json_object_put(o);
 
 	return ret;
 }
 
+/*
+ * Set the program config from a recept. Each recept is only parsed once,
+ * the result is shared by all copies of the base config. The pointers of
+ * the program config must not be modified.
+ */
+int init_prog_config(struct config *cfg, const char *cfg_file)
+{
+	struct config *base = cfg->base ? cfg->base : cfg;
+	struct recept *r;
+	int ret = 0;
+
+	pthread_mutex_lock(&recept_lock);
+
+	for (r = base->recepts; r; r = r->next) {
+		if (strcmp(r->path, cfg_file) == 0)
+			break;
+	}
+
+	if (!r) {
+		r = calloc(1, sizeof(*r));
+		if (!r) {
+			ret = -1;
+			goto out;
+		}
+
+		r->path = strdup(cfg_file);
+		if (!r->path) {
+			free(r);
+			ret = -1;
+			goto out;
+		}
+
+		ret = read_recept(cfg_file, &r->prog_config);
+		if (ret != 0) {
+			free_prog_config(&r->prog_config);
+			free(r->path);
+			free(r);
+			goto out;
+		}
+
+		r->next = base->recepts;
+		base->recepts = r;
+	}
+
+	cfg->prog_config = r->prog_config;
+out:
+	pthread_mutex_unlock(&recept_lock);
+
+	return ret;
+}
+
+/*
+ * Create a copy of the base config for a single dump. The copy shares
+ * all data of the base config, which must be freed last.
+ */
+struct config *copy_config(struct config *cfg)
+{
+	struct config *copy;
+
+	copy = malloc(sizeof(*copy));
+	if (!copy)
+		return NULL;
+
+	*copy = *cfg;
+	memset(&copy->prog_config, 0, sizeof(copy->prog_config));
+	copy->recepts = NULL;
+	copy->image = NULL;
+	copy->base = cfg;
+
+	return copy;
+}
+
+static bool in_image(struct config *cfg, void *p)
+{
+	return ((char *)p >= (char *)cfg->image &&
+		(char *)p < (char *)cfg->image + cfg->image_size);
+}
+
 void free_config(struct config *cfg)
 {
-	struct interesting_buffer *buf;
 	struct interesting_prog *prog;
-	int i;
+	struct recept *r;
+
+	/* a copy does not own any data */
+	if (cfg->base) {
+		free(cfg);
+		return;
+	}
+
+	if (cfg->image) {
+		/* only recepts parsed later are not in the image */
+		while (cfg->recepts && !in_image(cfg, cfg->recepts)) {
+			r = cfg->recepts;
+			cfg->recepts = r->next;
+			free_prog_config(&r->prog_config);
+			free(r->path);
+			free(r);
+		}
+
+		munmap(cfg->image, cfg->image_size);
+		return;
+	}
 
 	if (cfg->base_dir)
 		free(cfg->base_dir);
+	if (cfg->sym_cache_dir)
+		free(cfg->sym_cache_dir);
 
 	while (cfg->ilist) {
 		prog = cfg->ilist;
@@ -736,28 +1100,597 @@ void free_config(struct config *cfg)
 			free(prog->comm);
 		if (prog->recept)
 			free(prog->recept);
+		if (prog->comm_glob)
+			free(prog->comm_glob);
+		if (prog->exe_glob)
+			free(prog->exe_glob);
 		free(prog);
 	}
 
-	for (i = 0; i < cfg->prog_config.maps.nglobs; i++)
-		free(cfg->prog_config.maps.name_globs[i]);
-	if (cfg->prog_config.maps.name_globs)
-		free(cfg->prog_config.maps.name_globs);
+	/* the program config belongs to one of the recepts */
+	while (cfg->recepts) {
+		r = cfg->recepts;
+		cfg->recepts = r->next;
+		free_prog_config(&r->prog_config);
+		free(r->path);
+		free(r);
+	}
 
-	while (cfg->prog_config.buffers) {
-		buf = cfg->prog_config.buffers;
-		cfg->prog_config.buffers = buf->next;
-		if (buf->symname)
-			free(buf->symname);
-		if (buf->ident)
-			free(buf->ident);
-		free(buf);
+	free(cfg);
+}
+
+/*
+ * Compiled config image
+ *
+ * The image contains the base config with all recepts of its watch list
+ * already parsed. All pointers are stored as offsets into the image and
+ * listed in a relocation table, so that loading only needs a private
+ * mapping of the file and adding its address to each pointer.
+ */
+
+#define CONFIG_IMAGE_MAGIC "MCDCFGIM"
+#define CONFIG_IMAGE_VERSION 3
+
+struct config_image_head {
+	char magic[8];
+	uint32_t version;
+	uint32_t ptr_size;
+	uint32_t config_size;
+	uint32_t prog_config_size;
+	uint64_t size;
+	/* offset of the struct config */
+	uint64_t config;
+	/* JSON files the image was compiled from */
+	uint64_t sources;
+	uint32_t nsources;
+	/* offsets of all pointers in the image */
+	uint32_t nrelocs;
+	uint64_t relocs;
+};
+
+struct config_image_source {
+	uint64_t path;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t size;
+};
+
+struct image_buf {
+	char *data;
+	size_t len;
+	size_t size;
+	uint64_t *relocs;
+	size_t nrelocs;
+	size_t relocs_size;
+	int err;
+};
+
+static int image_path(const char *cfg_file, char *path, size_t size)
+{
+	size_t len = strlen(cfg_file);
+	int ret;
+
+	/* foo.cfg.json => foo.cfg.bin */
+	if (len > 5 && strcmp(cfg_file + len - 5, ".json") == 0)
+		len -= 5;
+
+	ret = snprintf(path, size, "%.*s.bin", (int)len, cfg_file);
+	if (ret < 0 || (size_t)ret >= size)
+		return -1;
+
+	return 0;
+}
+
+/* Returns the offset of a zeroed, aligned area (0 on error). */
+static uint64_t img_alloc(struct image_buf *b, size_t len)
+{
+	size_t off = (b->len + 7) & ~(size_t)7;
+	size_t size;
+	char *data;
+
+	if (b->err)
+		return 0;
+
+	if (off + len > b->size) {
+		size = b->size ? b->size : 4096;
+		while (off + len > size)
+			size *= 2;
+
+		data = realloc(b->data, size);
+		if (!data) {
+			b->err = ENOMEM;
+			return 0;
+		}
+		memset(data + b->size, 0, size - b->size);
+		b->data = data;
+		b->size = size;
 	}
 
-	if (cfg->prog_config.core_compressor)
-		free(cfg->prog_config.core_compressor);
-	if (cfg->prog_config.core_compressor_ext)
-		free(cfg->prog_config.core_compressor_ext);
+	b->len = off + len;
 
-	free(cfg);
+	return off;
+}
+
+static void img_set_ptr(struct image_buf *b, uint64_t field, uint64_t target)
+{
+	uint64_t *relocs;
+	uintptr_t val = target;
+
+	if (b->err || target == 0)
+		return;
+
+	if (b->nrelocs == b->relocs_size) {
+		b->relocs_size = b->relocs_size ? b->relocs_size * 2 : 64;
+		relocs = realloc(b->relocs,
+				 b->relocs_size * sizeof(*b->relocs));
+		if (!relocs) {
+			b->err = ENOMEM;
+			return;
+		}
+		b->relocs = relocs;
+	}
+
+	memcpy(b->data + field, &val, sizeof(val));
+	b->relocs[b->nrelocs++] = field;
+}
+
+static uint64_t img_str(struct image_buf *b, const char *str)
+{
+	uint64_t off;
+	size_t len;
+
+	if (!str)
+		return 0;
+
+	len = strlen(str) + 1;
+	off = img_alloc(b, len);
+	if (off)
+		memcpy(b->data + off, str, len);
+
+	return off;
+}
+
+/* a compiled glob has no pointers, it is copied as is */
+static uint64_t img_glob(struct image_buf *b, const struct glob *g)
+{
+	uint64_t off;
+
+	if (!g)
+		return 0;
+
+	off = img_alloc(b, g->size);
+	if (off)
+		memcpy(b->data + off, g, g->size);
+
+	return off;
+}
+
+static void img_prog_config(struct image_buf *b, uint64_t pc_off,
+			    const struct prog_config *pc)
+{
+	struct interesting_buffer *buf;
+	struct interesting_buffer tb;
+	struct prog_config tmp;
+	uint64_t field;
+	uint64_t off;
+	size_t i;
+
+	tmp = *pc;
+	tmp.maps.name_globs = NULL;
+	tmp.maps.name_globs_compiled = NULL;
+	tmp.buffers = NULL;
+	tmp.core_compressor = NULL;
+	tmp.core_compressor_ext = NULL;
+	memcpy(b->data + pc_off, &tmp, sizeof(tmp));
+
+	if (pc->maps.nglobs > 0) {
+		off = img_alloc(b, pc->maps.nglobs * sizeof(char *));
+		img_set_ptr(b, pc_off + offsetof(struct prog_config,
+						 maps.name_globs), off);
+		for (i = 0; off && i < pc->maps.nglobs; i++) {
+			img_set_ptr(b, off + (i * sizeof(char *)),
+				    img_str(b, pc->maps.name_globs[i]));
+		}
+	}
+
+	if (pc->maps.name_globs_compiled) {
+		off = img_alloc(b, pc->maps.nglobs * sizeof(struct glob *));
+		img_set_ptr(b, pc_off + offsetof(struct prog_config,
+						 maps.name_globs_compiled), off);
+		for (i = 0; off && i < pc->maps.nglobs; i++) {
+			img_set_ptr(b, off + (i * sizeof(struct glob *)),
+				    img_glob(b, pc->maps.name_globs_compiled[i]));
+		}
+	}
+
+	field = pc_off + offsetof(struct prog_config, buffers);
+	for (buf = pc->buffers; buf; buf = buf->next) {
+		off = img_alloc(b, sizeof(*buf));
+		if (!off)
+			return;
+
+		tb = *buf;
+		tb.symname = NULL;
+		tb.ident = NULL;
+		tb.next = NULL;
+		memcpy(b->data + off, &tb, sizeof(tb));
+
+		img_set_ptr(b, field, off);
+		img_set_ptr(b, off + offsetof(struct interesting_buffer,
+					      symname), img_str(b, buf->symname));
+		img_set_ptr(b, off + offsetof(struct interesting_buffer, ident),
+			    img_str(b, buf->ident));
+
+		field = off + offsetof(struct interesting_buffer, next);
+	}
+
+	img_set_ptr(b, pc_off + offsetof(struct prog_config, core_compressor),
+		    img_str(b, pc->core_compressor));
+	img_set_ptr(b, pc_off + offsetof(struct prog_config,
+					 core_compressor_ext),
+		    img_str(b, pc->core_compressor_ext));
+}
+
+static void img_config(struct image_buf *b, uint64_t c_off,
+		       const struct config *cfg)
+{
+	struct interesting_prog *prog;
+	struct interesting_prog tp;
+	struct config tmp;
+	struct recept *r;
+	struct recept tr;
+	uint64_t field;
+	uint64_t off;
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.io_uring = cfg->io_uring;
+	memcpy(b->data + c_off, &tmp, sizeof(tmp));
+
+	img_set_ptr(b, c_off + offsetof(struct config, base_dir),
+		    img_str(b, cfg->base_dir));
+	img_set_ptr(b, c_off + offsetof(struct config, sym_cache_dir),
+		    img_str(b, cfg->sym_cache_dir));
+
+	/* watch rules, in order */
+	field = c_off + offsetof(struct config, ilist);
+	for (prog = cfg->ilist; prog; prog = prog->next) {
+		off = img_alloc(b, sizeof(*prog));
+		if (!off)
+			return;
+
+		memset(&tp, 0, sizeof(tp));
+		memcpy(b->data + off, &tp, sizeof(tp));
+
+		img_set_ptr(b, field, off);
+		img_set_ptr(b, off + offsetof(struct interesting_prog, comm),
+			    img_str(b, prog->comm));
+		img_set_ptr(b, off + offsetof(struct interesting_prog, exe),
+			    img_str(b, prog->exe));
+		img_set_ptr(b, off + offsetof(struct interesting_prog, recept),
+			    img_str(b, prog->recept));
+		img_set_ptr(b, off + offsetof(struct interesting_prog,
+					      comm_glob),
+			    img_glob(b, prog->comm_glob));
+		img_set_ptr(b, off + offsetof(struct interesting_prog,
+					      exe_glob),
+			    img_glob(b, prog->exe_glob));
+
+		field = off + offsetof(struct interesting_prog, next);
+	}
+
+	/* parsed recepts */
+	field = c_off + offsetof(struct config, recepts);
+	for (r = cfg->recepts; r; r = r->next) {
+		off = img_alloc(b, sizeof(*r));
+		if (!off)
+			return;
+
+		memset(&tr, 0, sizeof(tr));
+		memcpy(b->data + off, &tr, sizeof(tr));
+
+		img_set_ptr(b, field, off);
+		img_set_ptr(b, off + offsetof(struct recept, path),
+			    img_str(b, r->path));
+		img_prog_config(b, off + offsetof(struct recept, prog_config),
+				&r->prog_config);
+
+		field = off + offsetof(struct recept, next);
+	}
+}
+
+static int img_sources(struct image_buf *b, uint64_t head_off,
+		       const char *cfg_file, const struct config *cfg)
+{
+	struct config_image_head *head;
+	struct config_image_source src;
+	struct recept *r;
+	struct stat sb;
+	const char *path;
+	uint32_t n = 0;
+	uint64_t off;
+	uint64_t str;
+
+	for (r = cfg->recepts; r; r = r->next)
+		n++;
+
+	/* the config file and all recept files (except defaults) */
+	off = img_alloc(b, (n + 1) * sizeof(src));
+	if (!off)
+		return -1;
+
+	n = 0;
+	path = cfg_file;
+	r = cfg->recepts;
+	while (path) {
+		if (path[0] != 0) {
+			if (stat(path, &sb) != 0) {
+				info("unable to stat \'%s\': %s", path,
+				     strerror(errno));
+				return -1;
+			}
+
+			str = img_str(b, path);
+			if (!str)
+				return -1;
+
+			src.path = str;
+			src.mtime_sec = sb.st_mtim.tv_sec;
+			src.mtime_nsec = sb.st_mtim.tv_nsec;
+			src.size = sb.st_size;
+			memcpy(b->data + off + (n * sizeof(src)), &src,
+			       sizeof(src));
+			n++;
+		}
+
+		path = r ? r->path : NULL;
+		r = r ? r->next : NULL;
+	}
+
+	head = (struct config_image_head *)(b->data + head_off);
+	head->sources = off;
+	head->nsources = n;
+
+	return 0;
+}
+
+static int write_image(const char *path, struct image_buf *b)
+{
+	char tmp_path[PATH_MAX];
+	size_t done = 0;
+	ssize_t ret;
+	int fd;
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >=
+	    (int)sizeof(tmp_path)) {
+		return -1;
+	}
+
+	fd = open(tmp_path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (fd < 0) {
+		info("unable to create \'%s\': %s", tmp_path, strerror(errno));
+		return -1;
+	}
+
+	while (done < b->len) {
+		ret = write(fd, b->data + done, b->len - done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		done += ret;
+	}
+
+	if (close(fd) != 0 || done < b->len) {
+		info("unable to write \'%s\': %s", tmp_path, strerror(errno));
+		unlink(tmp_path);
+		return -1;
+	}
+
+	/* replace the image atomically, a dump may be loading it */
+	if (rename(tmp_path, path) != 0) {
+		info("unable to rename \'%s\': %s", tmp_path, strerror(errno));
+		unlink(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Validate the config file and all its recept files and write them as
+ * a compiled config image, which is used by init_config() as long as
+ * none of the files change.
+ */
+int compile_config(const char *cfg_file)
+{
+	struct config_image_head *head;
+	struct interesting_prog *prog;
+	char path[PATH_MAX];
+	struct image_buf b;
+	struct config *cfg;
+	uint64_t head_off;
+	uint64_t c_off;
+	uint64_t off;
+	int ret = -1;
+
+	if (image_path(cfg_file, path, sizeof(path)) != 0)
+		return -1;
+
+	cfg = read_config_file(cfg_file);
+	if (!cfg)
+		return -1;
+
+	if (!cfg->base_dir) {
+		info("no base_dir set in config file");
+		goto out;
+	}
+
+	/* parse each recept, this also validates them */
+	for (prog = cfg->ilist; prog; prog = prog->next) {
+		if (init_prog_config(cfg, prog->recept) != 0) {
+			info("unable to read recept file: %s", prog->recept);
+			goto out;
+		}
+	}
+
+	memset(&b, 0, sizeof(b));
+
+	head_off = img_alloc(&b, sizeof(*head));
+	c_off = img_alloc(&b, sizeof(*cfg));
+	if (b.err)
+		goto out_free;
+
+	img_config(&b, c_off, cfg);
+	if (img_sources(&b, head_off, cfg_file, cfg) != 0 || b.err)
+		goto out_free;
+
+	/* the relocation table is not relocated itself */
+	off = img_alloc(&b, b.nrelocs * sizeof(*b.relocs));
+	if (b.err)
+		goto out_free;
+	memcpy(b.data + off, b.relocs, b.nrelocs * sizeof(*b.relocs));
+
+	head = (struct config_image_head *)(b.data + head_off);
+	memcpy(head->magic, CONFIG_IMAGE_MAGIC, sizeof(head->magic));
+	head->version = CONFIG_IMAGE_VERSION;
+	head->ptr_size = sizeof(void *);
+	head->config_size = sizeof(struct config);
+	head->prog_config_size = sizeof(struct prog_config);
+	head->size = b.len;
+	head->config = c_off;
+	head->nrelocs = b.nrelocs;
+	head->relocs = off;
+
+	ret = write_image(path, &b);
+	if (ret == 0)
+		info("compiled config: %s", path);
+out_free:
+	if (b.err)
+		info("unable to compile config: %s", strerror(b.err));
+	free(b.relocs);
+	free(b.data);
+out:
+	free_config(cfg);
+	return ret;
+}
+
+static bool image_range_ok(uint64_t off, uint64_t len, uint64_t size)
+{
+	return (off <= size && len <= size - off);
+}
+
+/*
+ * Map a compiled config image. Returns NULL if there is none or if it
+ * does not match the JSON files (anymore).
+ */
+static struct config *load_config_image(const char *cfg_file)
+{
+	struct config_image_head *head;
+	struct config_image_source *src;
+	char path[PATH_MAX];
+	struct config *cfg;
+	uint64_t *relocs;
+	size_t map_size;
+	struct stat sb;
+	uintptr_t val;
+	uint32_t i;
+	char *base;
+	int fd;
+
+	if (image_path(cfg_file, path, sizeof(path)) != 0)
+		return NULL;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(*head)) {
+		close(fd);
+		return NULL;
+	}
+	map_size = sb.st_size;
+
+	/* private, the pointers are relocated in place */
+	base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		    fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	head = (struct config_image_head *)base;
+
+	if (memcmp(head->magic, CONFIG_IMAGE_MAGIC, sizeof(head->magic)) != 0 ||
+	    head->version != CONFIG_IMAGE_VERSION ||
+	    head->ptr_size != sizeof(void *) ||
+	    head->config_size != sizeof(struct config) ||
+	    head->prog_config_size != sizeof(struct prog_config) ||
+	    head->size != map_size ||
+	    !image_range_ok(head->config, sizeof(*cfg), head->size) ||
+	    !image_range_ok(head->sources, (uint64_t)head->nsources *
+			    sizeof(*src), head->size) ||
+	    !image_range_ok(head->relocs, (uint64_t)head->nrelocs *
+			    sizeof(*relocs), head->size)) {
+		info("WARNING: ignoring invalid config image: %s", path);
+		goto out_err;
+	}
+
+	/* the image is stale if any JSON file changed */
+	src = (struct config_image_source *)(base + head->sources);
+	for (i = 0; i < head->nsources; i++) {
+		if (src[i].path >= head->size ||
+		    !memchr(base + src[i].path, 0, head->size - src[i].path)) {
+			info("WARNING: ignoring invalid config image: %s",
+			     path);
+			goto out_err;
+		}
+
+		if (stat(base + src[i].path, &sb) != 0 ||
+		    sb.st_mtim.tv_sec != src[i].mtime_sec ||
+		    sb.st_mtim.tv_nsec != src[i].mtime_nsec ||
+		    sb.st_size != src[i].size) {
+			info("config image is stale, reading %s", cfg_file);
+			goto out_err;
+		}
+	}
+
+	relocs = (uint64_t *)(base + head->relocs);
+	for (i = 0; i < head->nrelocs; i++) {
+		if (!image_range_ok(relocs[i], sizeof(val), head->size) ||
+		    (relocs[i] & (sizeof(val) - 1)) != 0) {
+			info("WARNING: ignoring invalid config image: %s",
+			     path);
+			goto out_err;
+		}
+
+		memcpy(&val, base + relocs[i], sizeof(val));
+		if (val >= head->size) {
+			info("WARNING: ignoring invalid config image: %s",
+			     path);
+			goto out_err;
+		}
+
+		val += (uintptr_t)base;
+		memcpy(base + relocs[i], &val, sizeof(val));
+	}
+
+	cfg = (struct config *)(base + head->config);
+	cfg->image = base;
+	cfg->image_size = head->size;
+
+	return cfg;
+out_err:
+	munmap(base, map_size);
+	return NULL;
+}
+
+struct config *init_config(const char *cfg_file)
+{
+	struct config *cfg;
+
+	cfg = load_config_image(cfg_file);
+	if (cfg)
+		return cfg;
+
+	return read_config_file(cfg_file);
 }
@@ -9,11 +9,17 @@
 
 #include <stdbool.h>
 
+struct glob;
+
 struct interesting_prog {
 	char *comm;
 	char *exe;
 	char *recept;
 
+	/* compiled comm/exe rules */
+	struct glob *comm_glob;
+	struct glob *exe_glob;
+
 	struct interesting_prog *next;
 };
 
@@ -35,6 +41,17 @@ struct stack_config {
 struct maps_config {
 	char **name_globs;
 	size_t nglobs;
+
+	/* compiled name_globs, NULL entries are matched uncompiled */
+	struct glob **name_globs_compiled;
+};
+
+/* core compression methods */
+enum core_compression {
+	COMPRESS_EXTERNAL = 0,
+	COMPRESS_ZSTD,
+	COMPRESS_GZIP,
+	COMPRESS_XZ,
 };
 
 struct prog_config {
@@ -43,29 +60,59 @@ struct prog_config {
 	struct interesting_buffer *buffers;
 	char *core_compressor;
 	char *core_compressor_ext;
+	unsigned int core_compress_method;
+	int core_compress_level;
+	int core_compress_threads;
+	bool core_compress_seekable;
+	bool core_compress_sparse;
 	bool core_in_tar;
 	bool core_compressed;
 	bool dump_fat_core;
+	bool stream_core;
 	bool dump_auxv_so_list;
 	bool dump_pthread_list;
 	bool dump_robust_mutex_list;
 	bool write_proc_info;
 	bool write_debug_log;
 	bool live_dumper;
+	int live_dumper_threads;
 	unsigned int dump_scope;
 };
 
+/* a recept file, parsed at most once per invocation */
+struct recept {
+	char *path;
+	struct prog_config prog_config;
+
+	struct recept *next;
+};
+
 struct config {
 	char *base_dir;
+	char *sym_cache_dir;
+	bool io_uring;
 	struct interesting_prog *ilist;
 	struct prog_config prog_config;
+
+	/* parsed recepts, owned by the base config */
+	struct recept *recepts;
+
+	/* base config of a per-dump copy (see copy_config()) */
+	struct config *base;
+
+	/* compiled config image this config is mapped from */
+	void *image;
+	size_t image_size;
 };
 
 const char *get_prog_recept(struct config *cfg, const char *comm,
 			    const char *exe);
 struct config *init_config(const char *cfg_file);
+struct config *copy_config(struct config *cfg);
+int compile_config(const char *cfg_file);
 int init_prog_config(struct config *cfg, const char *cfg_file);
 int simple_match(const char *pattern, const char *string);
+int glob_match(const struct glob *g, const char *string);
 void free_config(struct config *cfg);
 
 #endif /* CONFIG_H */
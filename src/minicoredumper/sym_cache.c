@@ -0,0 +1,499 @@
+/*
+ * Copyright (c) 2012-2018 Linutronix GmbH. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * On-disk symbol index cache.
+ *
+ * For each object with a build-id, a file <build-id>.sym is stored in the
+ * cache directory. It holds only the name hashes and values of the
+ * defined symbols, grouped by hash bucket, so that it can be mmap'd and
+ * searched without opening the object with libelf. A rebuilt object gets
+ * a new build-id and thus a new cache file.
+ *
+ * File layout (native byte order):
+ *
+ *   struct sym_cache_hdr
+ *   uint32_t buckets[nbuckets + 1]   (first entry of each bucket)
+ *   padding to 8 bytes
+ *   struct sym_cache_entry entries[count]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <elf.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "sym_cache.h"
+
+#define SYM_CACHE_MAGIC "MCDSYMC"
+#define SYM_CACHE_VERSION 1
+
+/* do not search huge note segments for the build-id */
+#define NOTE_MAX_SIZE (64 * 1024)
+
+struct sym_cache_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t id_len;
+	unsigned char id[SYM_CACHE_MAX_ID];
+	uint32_t nbuckets;
+	uint32_t count;
+};
+
+struct sym_cache {
+	void *map;
+	size_t size;
+	uint32_t nbuckets;
+	uint32_t count;
+	const uint32_t *buckets;
+	const struct sym_cache_entry *entries;
+};
+
+/*
+ * The first hash is the .gnu.hash function, the second one (FNV-1a)
+ * makes collisions between different names practically impossible.
+ */
+void sym_cache_hash(const char *name, uint32_t *hash, uint32_t *hash2)
+{
+	const unsigned char *p = (const unsigned char *)name;
+	uint32_t h = 5381;
+	uint32_t h2 = 2166136261U;
+
+	for (; *p; p++) {
+		h = (h << 5) + h + *p;
+		h2 = (h2 ^ *p) * 16777619U;
+	}
+
+	*hash = h;
+	*hash2 = h2;
+}
+
+static size_t entries_offset(uint32_t nbuckets)
+{
+	size_t off;
+
+	off = sizeof(struct sym_cache_hdr) + ((nbuckets + 1) * sizeof(uint32_t));
+
+	return (off + 7) & ~7UL;
+}
+
+static int pread_all(int fd, void *buf, size_t len, off_t off)
+{
+	ssize_t r;
+
+	r = pread(fd, buf, len, off);
+	if (r < 0 || (size_t)r != len)
+		return -1;
+
+	return 0;
+}
+
+static int find_build_id(const unsigned char *buf, size_t size,
+			 size_t align, unsigned char *id, size_t *len)
+{
+	const Elf32_Nhdr *nhdr;
+	size_t namesz;
+	size_t descsz;
+	size_t pos = 0;
+
+	while (pos + sizeof(*nhdr) <= size) {
+		nhdr = (const Elf32_Nhdr *)(buf + pos);
+		pos += sizeof(*nhdr);
+
+		namesz = (nhdr->n_namesz + align - 1) & ~(align - 1);
+		descsz = (nhdr->n_descsz + align - 1) & ~(align - 1);
+
+		if (namesz > size - pos || descsz > size - pos - namesz)
+			break;
+
+		if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+		    memcmp(buf + pos, "GNU", 4) == 0) {
+			if (nhdr->n_descsz == 0 ||
+			    nhdr->n_descsz > SYM_CACHE_MAX_ID) {
+				return -1;
+			}
+			memcpy(id, buf + pos + namesz, nhdr->n_descsz);
+			*len = nhdr->n_descsz;
+			return 0;
+		}
+
+		pos += namesz + descsz;
+	}
+
+	return -1;
+}
+
+/*
+ * Read the build-id of an object file from its PT_NOTE segments.
+ */
+int sym_cache_build_id(const char *file, unsigned char *id, size_t *len)
+{
+	union {
+		unsigned char ident[EI_NIDENT];
+		Elf32_Ehdr e32;
+		Elf64_Ehdr e64;
+	} ehdr;
+	unsigned char *note = NULL;
+	unsigned long phoff;
+	unsigned int phnum;
+	int err = -1;
+	int is64;
+	int fd;
+	int i;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (pread_all(fd, &ehdr, sizeof(ehdr), 0) != 0)
+		goto out;
+
+	if (memcmp(ehdr.ident, ELFMAG, SELFMAG) != 0)
+		goto out;
+
+	is64 = (ehdr.ident[EI_CLASS] == ELFCLASS64);
+
+	if (is64) {
+		phoff = ehdr.e64.e_phoff;
+		phnum = ehdr.e64.e_phnum;
+	} else {
+		phoff = ehdr.e32.e_phoff;
+		phnum = ehdr.e32.e_phnum;
+	}
+
+	for (i = 0; i < (int)phnum; i++) {
+		unsigned long offset;
+		unsigned long size;
+		unsigned long align;
+
+		if (is64) {
+			Elf64_Phdr p;
+
+			if (pread_all(fd, &p, sizeof(p),
+				      phoff + (i * sizeof(p))) != 0) {
+				goto out;
+			}
+			if (p.p_type != PT_NOTE)
+				continue;
+			offset = p.p_offset;
+			size = p.p_filesz;
+			align = p.p_align;
+		} else {
+			Elf32_Phdr p;
+
+			if (pread_all(fd, &p, sizeof(p),
+				      phoff + (i * sizeof(p))) != 0) {
+				goto out;
+			}
+			if (p.p_type != PT_NOTE)
+				continue;
+			offset = p.p_offset;
+			size = p.p_filesz;
+			align = p.p_align;
+		}
+
+		if (size == 0 || size > NOTE_MAX_SIZE)
+			continue;
+
+		/* notes are 4-byte aligned unless the segment says 8 */
+		if (align != 8)
+			align = 4;
+
+		free(note);
+		note = malloc(size);
+		if (!note)
+			goto out;
+
+		if (pread_all(fd, note, size, offset) != 0)
+			continue;
+
+		if (find_build_id(note, size, align, id, len) == 0) {
+			err = 0;
+			break;
+		}
+	}
+out:
+	free(note);
+	close(fd);
+	return err;
+}
+
+static char *alloc_cache_path(const char *dir, const unsigned char *id,
+			      size_t id_len)
+{
+	char hex[(SYM_CACHE_MAX_ID * 2) + 1];
+	char *path;
+	size_t i;
+
+	for (i = 0; i < id_len; i++)
+		sprintf(&hex[i * 2], "%02x", id[i]);
+	hex[i * 2] = 0;
+
+	if (asprintf(&path, "%s/%s.sym", dir, hex) == -1)
+		return NULL;
+
+	return path;
+}
+
+struct sym_cache *sym_cache_open(const char *dir, const unsigned char *id,
+				 size_t id_len)
+{
+	const struct sym_cache_hdr *hdr;
+	struct sym_cache *sc = NULL;
+	size_t off;
+	struct stat s;
+	char *path;
+	void *map;
+	int fd;
+
+	path = alloc_cache_path(dir, id, id_len);
+	if (!path)
+		return NULL;
+
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &s) != 0 || s.st_size < (off_t)sizeof(*hdr)) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	hdr = map;
+
+	/* sanity checks */
+	if (memcmp(hdr->magic, SYM_CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    hdr->version != SYM_CACHE_VERSION || hdr->id_len != id_len ||
+	    memcmp(hdr->id, id, id_len) != 0 || hdr->nbuckets == 0 ||
+	    (hdr->nbuckets & (hdr->nbuckets - 1)) != 0) {
+		goto out_err;
+	}
+
+	off = entries_offset(hdr->nbuckets);
+	if (off > (size_t)s.st_size ||
+	    hdr->count > (s.st_size - off) / sizeof(struct sym_cache_entry)) {
+		goto out_err;
+	}
+
+	sc = calloc(1, sizeof(*sc));
+	if (!sc)
+		goto out_err;
+
+	sc->map = map;
+	sc->size = s.st_size;
+	sc->nbuckets = hdr->nbuckets;
+	sc->count = hdr->count;
+	sc->buckets = (const uint32_t *)(hdr + 1);
+	sc->entries = (const struct sym_cache_entry *)((char *)map + off);
+
+	return sc;
+out_err:
+	munmap(map, s.st_size);
+	return NULL;
+}
+
+int sym_cache_lookup(struct sym_cache *sc, uint32_t hash, uint32_t hash2,
+		     uint64_t *value)
+{
+	uint32_t b = hash & (sc->nbuckets - 1);
+	uint32_t end;
+	uint32_t i;
+
+	end = sc->buckets[b + 1];
+	if (end > sc->count)
+		end = sc->count;
+
+	for (i = sc->buckets[b]; i < end; i++) {
+		if (sc->entries[i].hash == hash &&
+		    sc->entries[i].hash2 == hash2) {
+			*value = sc->entries[i].value;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+void sym_cache_close(struct sym_cache *sc)
+{
+	munmap(sc->map, sc->size);
+	free(sc);
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t r;
+
+	while (len > 0) {
+		r = write(fd, p, len);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+/*
+ * Write a cache file for the given entries. Entries are grouped by bucket
+ * keeping their order, and only the first entry of any name is kept, so
+ * lookups return the same symbol a search of the symbol tables would.
+ * The file is written under a temporary name and then renamed so that
+ * concurrent dumps never see a partial file.
+ */
+int sym_cache_write(const char *dir, const unsigned char *id, size_t id_len,
+		    struct sym_cache_entry *entries, uint32_t count)
+{
+	static const char pad[8];
+	struct sym_cache_entry *sorted = NULL;
+	struct sym_cache_hdr hdr;
+	uint32_t *buckets = NULL;
+	uint32_t *pos = NULL;
+	char *tmp_path = NULL;
+	char *path = NULL;
+	uint32_t nbuckets;
+	uint32_t n = 0;
+	uint32_t b;
+	uint32_t i;
+	uint32_t j;
+	int err = -1;
+	int fd = -1;
+
+	if (id_len == 0 || id_len > SYM_CACHE_MAX_ID)
+		return -1;
+
+	path = alloc_cache_path(dir, id, id_len);
+	if (!path)
+		return -1;
+
+	/* another writer (e.g. a parallel live dump) got there first */
+	if (access(path, F_OK) == 0) {
+		err = 0;
+		goto out;
+	}
+
+	nbuckets = 1;
+	while (nbuckets < count / 2)
+		nbuckets <<= 1;
+
+	buckets = calloc(nbuckets + 1, sizeof(*buckets));
+	pos = calloc(nbuckets, sizeof(*pos));
+	sorted = malloc((count ? count : 1) * sizeof(*sorted));
+	if (!buckets || !pos || !sorted)
+		goto out;
+
+	/* stable counting sort by bucket, dropping duplicate names */
+	for (i = 0; i < count; i++)
+		buckets[(entries[i].hash & (nbuckets - 1)) + 1]++;
+	for (b = 0; b < nbuckets; b++) {
+		buckets[b + 1] += buckets[b];
+		pos[b] = buckets[b];
+	}
+	for (i = 0; i < count; i++) {
+		b = entries[i].hash & (nbuckets - 1);
+
+		for (j = buckets[b]; j < pos[b]; j++) {
+			if (sorted[j].hash == entries[i].hash &&
+			    sorted[j].hash2 == entries[i].hash2) {
+				break;
+			}
+		}
+		if (j == pos[b])
+			sorted[pos[b]++] = entries[i];
+	}
+
+	/* close the gaps left by dropped duplicates */
+	for (b = 0; b < nbuckets; b++) {
+		uint32_t len = pos[b] - buckets[b];
+
+		memmove(&sorted[n], &sorted[buckets[b]],
+			len * sizeof(*sorted));
+		buckets[b] = n;
+		n += len;
+	}
+	buckets[nbuckets] = n;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SYM_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = SYM_CACHE_VERSION;
+	hdr.id_len = id_len;
+	memcpy(hdr.id, id, id_len);
+	hdr.nbuckets = nbuckets;
+	hdr.count = n;
+
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+		goto out;
+
+	if (asprintf(&tmp_path, "%s.XXXXXX", path) == -1) {
+		tmp_path = NULL;
+		goto out;
+	}
+
+	/*
+	 * The name is unique per writer, so parallel dumps of the same
+	 * library never share a temporary file. mkstemp() creates it with
+	 * O_EXCL, so an existing file (or symlink) is never reused or
+	 * followed (the directory is configurable and may be writable by
+	 * others).
+	 */
+	fd = mkstemp(tmp_path);
+	if (fd < 0) {
+		/* not ours, do not unlink it */
+		free(tmp_path);
+		tmp_path = NULL;
+		goto out;
+	}
+
+	if (fchmod(fd, 0644) != 0)
+		goto out;
+
+	if (write_all(fd, &hdr, sizeof(hdr)) != 0 ||
+	    write_all(fd, buckets, (nbuckets + 1) * sizeof(*buckets)) != 0 ||
+	    write_all(fd, pad, entries_offset(nbuckets) - sizeof(hdr) -
+		      ((nbuckets + 1) * sizeof(*buckets))) != 0 ||
+	    write_all(fd, sorted, n * sizeof(*sorted)) != 0) {
+		goto out;
+	}
+
+	if (close(fd) != 0) {
+		fd = -1;
+		goto out;
+	}
+	fd = -1;
+
+	if (rename(tmp_path, path) != 0)
+		goto out;
+
+	err = 0;
+out:
+	if (fd >= 0)
+		close(fd);
+	if (err != 0 && tmp_path)
+		unlink(tmp_path);
+	free(tmp_path);
+	free(path);
+	free(sorted);
+	free(pos);
+	free(buckets);
+	return err;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2012-2018 Linutronix GmbH. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __SYM_CACHE_H__
+#define __SYM_CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* longest build-id that is supported */
+#define SYM_CACHE_MAX_ID 64
+
+struct sym_cache_entry {
+	uint32_t hash;
+	uint32_t hash2;
+	uint64_t value;
+};
+
+struct sym_cache;
+
+void sym_cache_hash(const char *name, uint32_t *hash, uint32_t *hash2);
+int sym_cache_build_id(const char *file, unsigned char *id, size_t *len);
+struct sym_cache *sym_cache_open(const char *dir, const unsigned char *id,
+				 size_t id_len);
+int sym_cache_lookup(struct sym_cache *sc, uint32_t hash, uint32_t hash2,
+		     uint64_t *value);
+void sym_cache_close(struct sym_cache *sc);
+int sym_cache_write(const char *dir, const unsigned char *id, size_t id_len,
+		    struct sym_cache_entry *entries, uint32_t count);
+
+#endif /* __SYM_CACHE_H__ */
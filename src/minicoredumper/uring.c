@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2012-2018 Linutronix GmbH. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Minimal io_uring interface using the raw system calls. Only fixed
+ * (registered) buffer reads and writes are supported.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+
+struct uring {
+	int fd;
+
+	/* submission queue */
+	void *sq_map;
+	size_t sq_map_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	/* completion queue */
+	void *cq_map;
+	size_t cq_map_size;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	unsigned int entries;
+	unsigned int to_submit;
+	unsigned int inflight;
+};
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+			      unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg,
+				 unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * Set up a ring and register the given buffers. Returns NULL if
+ * io_uring is not available, so that the caller can fall back to
+ * synchronous I/O.
+ */
+struct uring *uring_open(unsigned int entries, struct iovec *bufs,
+			 unsigned int nbufs)
+{
+	struct io_uring_params p;
+	struct uring *u;
+	char *sq;
+	char *cq;
+
+	u = calloc(1, sizeof(*u));
+	if (!u)
+		return NULL;
+
+	memset(&p, 0, sizeof(p));
+	u->fd = sys_io_uring_setup(entries, &p);
+	if (u->fd < 0) {
+		free(u);
+		return NULL;
+	}
+
+	u->sq_map_size = p.sq_off.array + (p.sq_entries * sizeof(unsigned int));
+	u->cq_map_size = p.cq_off.cqes +
+			 (p.cq_entries * sizeof(struct io_uring_cqe));
+
+	/* newer kernels map both rings at once */
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_map_size > u->sq_map_size)
+			u->sq_map_size = u->cq_map_size;
+		u->cq_map_size = 0;
+	}
+
+	u->sq_map = mmap(NULL, u->sq_map_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_map == MAP_FAILED)
+		goto out_close;
+
+	if (u->cq_map_size) {
+		u->cq_map = mmap(NULL, u->cq_map_size, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, u->fd,
+				 IORING_OFF_CQ_RING);
+		if (u->cq_map == MAP_FAILED)
+			goto out_unmap_sq;
+	} else {
+		u->cq_map = u->sq_map;
+	}
+
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		goto out_unmap_cq;
+
+	sq = u->sq_map;
+	u->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	u->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned int *)(sq + p.sq_off.array);
+
+	cq = u->cq_map;
+	u->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	u->entries = p.sq_entries;
+
+	if (sys_io_uring_register(u->fd, IORING_REGISTER_BUFFERS,
+				  bufs, nbufs) != 0) {
+		goto out_unmap_sqes;
+	}
+
+	return u;
+
+out_unmap_sqes:
+	munmap(u->sqes, u->sqes_size);
+out_unmap_cq:
+	if (u->cq_map_size)
+		munmap(u->cq_map, u->cq_map_size);
+out_unmap_sq:
+	munmap(u->sq_map, u->sq_map_size);
+out_close:
+	close(u->fd);
+	free(u);
+	return NULL;
+}
+
+static int queue_rw(struct uring *u, int op, int fd, void *buf, size_t len,
+		    off64_t off, int buf_index, uint64_t tag)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail;
+	unsigned int idx;
+
+	/* keep the completion queue from overflowing */
+	if (u->inflight + u->to_submit >= u->entries)
+		return -1;
+
+	tail = *u->sq_tail;
+	if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->entries)
+		return -1;
+
+	idx = tail & *u->sq_mask;
+	sqe = &u->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->off = off;
+	sqe->buf_index = buf_index;
+	sqe->user_data = tag;
+
+	u->sq_array[idx] = idx;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	u->to_submit++;
+
+	return 0;
+}
+
+int uring_queue_read(struct uring *u, int fd, void *buf, size_t len,
+		     off64_t off, int buf_index, uint64_t tag)
+{
+	return queue_rw(u, IORING_OP_READ_FIXED, fd, buf, len, off,
+			buf_index, tag);
+}
+
+int uring_queue_write(struct uring *u, int fd, void *buf, size_t len,
+		      off64_t off, int buf_index, uint64_t tag)
+{
+	return queue_rw(u, IORING_OP_WRITE_FIXED, fd, buf, len, off,
+			buf_index, tag);
+}
+
+/*
+ * Submit all queued requests and wait for one completion. Returns -1 if
+ * there is nothing to wait for.
+ */
+int uring_wait(struct uring *u, uint64_t *tag, int *res)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	int ret;
+
+	while (1) {
+		head = *u->cq_head;
+		if (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &u->cqes[head & *u->cq_mask];
+			*tag = cqe->user_data;
+			*res = cqe->res;
+			__atomic_store_n(u->cq_head, head + 1,
+					 __ATOMIC_RELEASE);
+			u->inflight--;
+			return 0;
+		}
+
+		if (u->inflight + u->to_submit == 0)
+			return -1;
+
+		ret = sys_io_uring_enter(u->fd, u->to_submit, 1,
+					 IORING_ENTER_GETEVENTS);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		u->inflight += ret;
+		u->to_submit -= ret;
+	}
+}
+
+void uring_close(struct uring *u)
+{
+	munmap(u->sqes, u->sqes_size);
+	if (u->cq_map_size)
+		munmap(u->cq_map, u->cq_map_size);
+	munmap(u->sq_map, u->sq_map_size);
+	close(u->fd);
+	free(u);
+}
+
+#else /* !HAVE_LINUX_IO_URING_H */
+
+struct uring *uring_open(unsigned int entries, struct iovec *bufs,
+			 unsigned int nbufs)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+int uring_queue_read(struct uring *u, int fd, void *buf, size_t len,
+		     off64_t off, int buf_index, uint64_t tag)
+{
+	return -1;
+}
+
+int uring_queue_write(struct uring *u, int fd, void *buf, size_t len,
+		      off64_t off, int buf_index, uint64_t tag)
+{
+	return -1;
+}
+
+int uring_wait(struct uring *u, uint64_t *tag, int *res)
+{
+	return -1;
+}
+
+void uring_close(struct uring *u)
+{
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
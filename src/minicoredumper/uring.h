@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2012-2018 Linutronix GmbH. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct uring;
+
+struct uring *uring_open(unsigned int entries, struct iovec *bufs,
+			 unsigned int nbufs);
+int uring_queue_read(struct uring *u, int fd, void *buf, size_t len,
+		     off64_t off, int buf_index, uint64_t tag);
+int uring_queue_write(struct uring *u, int fd, void *buf, size_t len,
+		      off64_t off, int buf_index, uint64_t tag);
+int uring_wait(struct uring *u, uint64_t *tag, int *res);
+void uring_close(struct uring *u);
+
+#endif /* __URING_H__ */